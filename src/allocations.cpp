@@ -0,0 +1,79 @@
+#include <cstdlib>
+#include <new>
+#include "allocations.h"
+using namespace std;
+
+#ifdef COUNT_ALLOCATIONS
+const bool g_CountsAllocations = true;
+
+static thread_local bool               t_CountAllocations = false;
+static thread_local unsigned long long t_Allocations      = 0;
+
+void* operator new(size_t size)
+{
+    if (t_CountAllocations) {
+        t_Allocations++;
+    }
+    void* ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+AllocationCounter::AllocationCounter()
+{
+    t_Allocations      = 0;
+    t_CountAllocations = true;
+}
+
+AllocationCounter::~AllocationCounter()
+{
+    t_CountAllocations = false;
+}
+
+unsigned long long AllocationCounter::Count() const
+{
+    return t_Allocations;
+}
+#else
+const bool g_CountsAllocations = false;
+
+AllocationCounter::AllocationCounter()
+{
+}
+
+AllocationCounter::~AllocationCounter()
+{
+}
+
+unsigned long long AllocationCounter::Count() const
+{
+    return 0;
+}
+#endif
@@ -0,0 +1,20 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+// Counting of the allocations made by the current thread, for the benchmark.
+// Replacing the global allocation functions would affect every command, so
+// only builds with COUNT_ALLOCATIONS defined count anything.
+
+// Whether this build counts allocations
+extern const bool g_CountsAllocations;
+
+// Counts the allocations of the current thread while it exists
+class AllocationCounter
+{
+public:
+    unsigned long long Count() const;
+
+    AllocationCounter();
+    ~AllocationCounter();
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include "analysis.h"
+using namespace std;
+
+namespace Lua {
+
+void ComputeLiveness(const vector<RegisterUsage>& usage, vector<RegisterSet>& liveIn, vector<RegisterSet>& liveOut)
+{
+    const int nCode = (int)usage.size();
+    liveIn .assign(nCode, RegisterSet());
+    liveOut.assign(nCode, RegisterSet());
+
+    // Iterate backwards until nothing changes; loops need a few rounds
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+        for (int pc = nCode - 1; pc >= 0; pc--)
+        {
+            const RegisterUsage& u = usage[pc];
+            if (u.length == 0) {
+                continue;
+            }
+
+            RegisterSet out;
+            for (int s = 0; s < u.nSuccessors; s++)
+            {
+                if (u.successors[s] >= 0 && u.successors[s] < nCode) {
+                    out |= liveIn[u.successors[s]];
+                }
+            }
+
+            const RegisterSet in = u.reads | (out & ~u.writes);
+            if (in != liveIn[pc])
+            {
+                liveIn[pc] = in;
+                changed    = true;
+            }
+            liveOut[pc] = out;
+        }
+    }
+}
+
+void GetLocalRegisters(const Function& function, vector<int>& registers)
+{
+    const vector<Local>& locals = function.locals;
+    registers.resize(locals.size());
+    for (size_t j = 0; j < locals.size(); j++)
+    {
+        registers[j] = 0;
+        for (size_t k = 0; k < j; k++)
+        {
+            if (locals[k].startPC <= locals[j].startPC && locals[j].startPC < locals[k].endPC) {
+                registers[j]++;
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,506 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+// Register usage, control flow and liveness of a function's code, shared by
+// the optimization passes
+
+#include <algorithm>
+#include <bitset>
+#include "opcodes.h"
+
+namespace Lua
+{
+
+typedef std::bitset<256> RegisterSet;
+
+// How an operand names a register
+enum OperandKind
+{
+    OPERAND_OTHER,      // not a register
+    OPERAND_REGISTER,   // a single register
+    OPERAND_RK,         // a single register or a constant
+    OPERAND_RANGE,      // the first or last register of a range
+};
+
+struct RegisterUsage
+{
+    OperandKind a, b, c;
+    RegisterSet reads;
+    RegisterSet writes;     // always written, so earlier values are dead
+    RegisterSet clobbers;   // possibly overwritten, e.g. conditionally or by a call
+    RegisterSet fixed;      // named implicitly, so they cannot be renumbered
+    int         highest;    // highest register named explicitly, or -1
+    int         length;     // number of code words, including pseudo-instructions
+    int         successors[2];
+    int         nSuccessors;
+};
+
+static inline void AddRange(RegisterSet& set, int first, int last)
+{
+    for (int r = first; r <= last && r < 256; r++) {
+        set.set(r);
+    }
+}
+
+//
+// Describes the registers an instruction reads and writes and where control
+// continues after it. Ranges that run to the top of the stack (operand 0 of
+// CALL, RETURN, SETLIST, VARARG) are taken to run up to maxStackSize.
+//
+template <typename Layout>
+void AnalyzeInstruction(const Function& function, const std::vector<DecodedInstruction>& code, int pc, RegisterUsage& usage)
+{
+    const DecodedInstruction& i   = code[pc];
+    const int                 top = function.maxStackSize - 1;
+    const int a = i.a, b = i.b, c = i.c;
+
+    usage.a = usage.b = usage.c = OPERAND_OTHER;
+    usage.reads.reset();
+    usage.writes.reset();
+    usage.clobbers.reset();
+    usage.fixed.reset();
+    usage.highest        = -1;
+    usage.length         = 1;
+    usage.nSuccessors    = 1;
+    usage.successors[0]  = pc + 1;
+
+    // Helpers for the common operand shapes
+    auto ReadRegister  = [&](int r) { usage.reads.set(r);  usage.highest = std::max(usage.highest, r); };
+    auto WriteRegister = [&](int r) { usage.writes.set(r); usage.highest = std::max(usage.highest, r); };
+    auto ReadRK        = [&](int rk) { if (!Layout::IsConstant(rk)) ReadRegister(rk); };
+    auto FixRange      = [&](int first, int last) { AddRange(usage.fixed, first, last); usage.highest = std::max(usage.highest, last); };
+    auto Jump          = [&](int offset) { usage.successors[usage.nSuccessors++] = pc + 1 + offset; };
+    auto Skip          = [&]() { usage.successors[usage.nSuccessors++] = pc + 2; };
+
+    switch (i.op)
+    {
+        case OP_MOVE:
+        case OP_UNM:
+        case OP_NOT:
+        case OP_LEN:
+            usage.a = usage.b = OPERAND_REGISTER;
+            WriteRegister(a);
+            ReadRegister(b);
+            break;
+
+        case OP_LOADK:
+        case OP_GETUPVAL:
+        case OP_GETGLOBAL:
+        case OP_NEWTABLE:
+            usage.a = OPERAND_REGISTER;
+            WriteRegister(a);
+            break;
+
+        case OP_LOADBOOL:
+            usage.a = OPERAND_REGISTER;
+            WriteRegister(a);
+            if (c != 0) {
+                usage.successors[0] = pc + 2;
+            }
+            break;
+
+        case OP_LOADNIL:
+            usage.a = usage.b = OPERAND_RANGE;
+            AddRange(usage.writes, a, b);
+            FixRange(a, b);
+            break;
+
+        case OP_GETTABLE:
+            usage.a = OPERAND_REGISTER;
+            usage.b = OPERAND_REGISTER;
+            usage.c = OPERAND_RK;
+            WriteRegister(a);
+            ReadRegister(b);
+            ReadRK(c);
+            break;
+
+        case OP_SETGLOBAL:
+        case OP_SETUPVAL:
+            usage.a = OPERAND_REGISTER;
+            ReadRegister(a);
+            break;
+
+        case OP_SETTABLE:
+            usage.a = OPERAND_REGISTER;
+            usage.b = usage.c = OPERAND_RK;
+            ReadRegister(a);
+            ReadRK(b);
+            ReadRK(c);
+            break;
+
+        case OP_SELF:
+            usage.a = OPERAND_RANGE;
+            usage.b = OPERAND_REGISTER;
+            usage.c = OPERAND_RK;
+            AddRange(usage.writes, a, a + 1);
+            FixRange(a, a + 1);
+            ReadRegister(b);
+            ReadRK(c);
+            break;
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+        case OP_POW:
+            usage.a = OPERAND_REGISTER;
+            usage.b = usage.c = OPERAND_RK;
+            WriteRegister(a);
+            ReadRK(b);
+            ReadRK(c);
+            break;
+
+        case OP_CONCAT:
+            usage.a = OPERAND_REGISTER;
+            usage.b = usage.c = OPERAND_RANGE;
+            WriteRegister(a);
+            AddRange(usage.reads, b, c);
+            FixRange(b, c);
+            break;
+
+        case OP_JMP:
+            usage.successors[0] = pc + 1 + i.sbx;
+            break;
+
+        case OP_EQ:
+        case OP_LT:
+        case OP_LE:
+            usage.b = usage.c = OPERAND_RK;
+            ReadRK(b);
+            ReadRK(c);
+            Skip();
+            break;
+
+        case OP_TEST:
+            if (Layout::IsNew) {
+                // if not (R(A) <=> C) then pc++
+                usage.a = OPERAND_REGISTER;
+                ReadRegister(a);
+            } else {
+                // if R(B) <=> C then pc++ else R(A) := R(B); A may be NO_REG
+                usage.b = OPERAND_REGISTER;
+                ReadRegister(b);
+                if (a < Layout::MAXSTACK) {
+                    usage.a = OPERAND_REGISTER;
+                    usage.clobbers.set(a);
+                    usage.highest = std::max(usage.highest, a);
+                }
+            }
+            Skip();
+            break;
+
+        case OP_TESTSET:
+            usage.a = usage.b = OPERAND_REGISTER;
+            usage.clobbers.set(a);
+            usage.highest = std::max(usage.highest, a);
+            ReadRegister(b);
+            Skip();
+            break;
+
+        case OP_CALL:
+        case OP_TAILCALL:
+            // The callee's frame starts above the function, so the call
+            // overwrites every register from A up
+            usage.a = OPERAND_RANGE;
+            AddRange(usage.reads, a, (b > 0) ? a + b - 1 : top);
+            AddRange(usage.clobbers, a, top);
+            if (c > 1) {
+                AddRange(usage.writes, a, a + c - 2);
+            }
+            FixRange(a, std::max(b > 0 ? a + b - 1 : a, c > 1 ? a + c - 2 : a));
+            AddRange(usage.fixed, a, (b == 0 || c == 0) ? top : a);
+            if (i.op == OP_TAILCALL) {
+                usage.nSuccessors = 0;
+            }
+            break;
+
+        case OP_RETURN:
+            if (b == 2) {
+                usage.a = OPERAND_REGISTER;
+                ReadRegister(a);
+            } else if (b != 1) {
+                usage.a = OPERAND_RANGE;
+                AddRange(usage.reads, a, (b > 0) ? a + b - 2 : top);
+                FixRange(a, (b > 0) ? a + b - 2 : a);
+                AddRange(usage.fixed, a, (b > 0) ? a + b - 2 : top);
+            }
+            usage.nSuccessors = 0;
+            break;
+
+        case OP_FORLOOP:
+        {
+            const int last = a + (Layout::IsNew ? 3 : 2);
+            usage.a = OPERAND_RANGE;
+            AddRange(usage.reads, a, a + 2);
+            AddRange(usage.clobbers, a, last);
+            FixRange(a, last);
+            Jump(i.sbx);
+            break;
+        }
+
+        case OP_FORPREP:
+            usage.a = OPERAND_RANGE;
+            AddRange(usage.reads, a, a + 2);
+            usage.clobbers.set(a);
+            FixRange(a, a + 3);
+            usage.successors[0] = pc + 1 + i.sbx;
+            break;
+
+        case OP_TFORPREP:
+            usage.a = OPERAND_RANGE;
+            usage.reads.set(a);
+            AddRange(usage.clobbers, a, a + 1);
+            FixRange(a, a + 1);
+            usage.successors[0] = pc + 1 + i.sbx;
+            break;
+
+        case OP_TFORLOOP:
+        {
+            // Calls the iterator, which overwrites everything above the
+            // results. Lua 5.1 calls it from a copy at A+3, for which the
+            // parser reserves three registers; Lua 5.0 copies it above the
+            // results, to A+C+3.
+            const int first = a + (Layout::IsNew ? 3 : 2);
+            const int last  = Layout::IsNew ? std::max(a + 2 + c, a + 5) : a + c + 5;
+            usage.a = OPERAND_RANGE;
+            AddRange(usage.reads, a, a + 2);
+            AddRange(usage.writes, first, a + 2 + c);
+            AddRange(usage.clobbers, a + 2, top);
+            FixRange(a, last);
+            AddRange(usage.fixed, a, top);
+            Skip();
+            break;
+        }
+
+        case OP_SETLIST:
+            usage.a = OPERAND_RANGE;
+            if (Layout::IsNew) {
+                AddRange(usage.reads, a, (b > 0) ? a + b : top);
+                FixRange(a, a + b);
+                AddRange(usage.fixed, a, (b > 0) ? a + b : top);
+                if (c == 0) {
+                    // The block number is stored in the next word
+                    usage.length        = 2;
+                    usage.successors[0] = pc + 2;
+                }
+            } else {
+                AddRange(usage.reads, a, a + 1 + i.bx % 32);
+                FixRange(a, a + 1 + i.bx % 32);
+            }
+            break;
+
+        case OP_SETLISTO:
+            usage.a = OPERAND_RANGE;
+            AddRange(usage.reads, a, top);
+            FixRange(a, a);
+            AddRange(usage.fixed, a, top);
+            break;
+
+        case OP_CLOSE:
+            // Closes the upvalues of the registers from A up
+            usage.a = OPERAND_RANGE;
+            break;
+
+        case OP_CLOSURE:
+        {
+            // The upvalues are described by the pseudo-instructions that
+            // follow. Captured registers stay shared with the closure.
+            usage.a = OPERAND_REGISTER;
+            WriteRegister(a);
+            const int nUpvalues = ((size_t)i.bx < function.functions.size()) ? function.functions[i.bx].nUpvalues : 0;
+            for (int j = 1; j <= nUpvalues && pc + j < (int)code.size(); j++)
+            {
+                if (code[pc + j].op == OP_MOVE)
+                {
+                    ReadRegister(code[pc + j].b);
+                    usage.fixed.set(code[pc + j].b);
+                }
+            }
+            usage.length        = 1 + nUpvalues;
+            usage.successors[0] = pc + 1 + nUpvalues;
+            break;
+        }
+
+        case OP_VARARG:
+            if (b == 2) {
+                usage.a = OPERAND_REGISTER;
+                WriteRegister(a);
+            } else {
+                usage.a = OPERAND_RANGE;
+                AddRange(usage.writes, a, (b > 0) ? a + b - 2 : top);
+                FixRange(a, (b > 0) ? a + b - 2 : a);
+                AddRange(usage.fixed, a, (b > 0) ? a + b - 2 : top);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Returns the number of registers that hold the arguments on entry. Vararg
+// functions of Lua 5.0, and those of Lua 5.1 compiled with LUA_COMPAT_VARARG
+// that use it, also get the 'arg' table.
+template <typename Layout>
+int GetParameterRegisters(const Function& function)
+{
+    const int hasArg = Layout::IsNew ? (function.isVararg & 4) : function.isVararg;
+    return function.nParameters + (hasArg != 0 ? 1 : 0);
+}
+
+// Analyzes every instruction; pseudo-instructions get an empty entry with
+// length 0. Returns false if the code has invalid opcodes.
+template <typename Layout>
+bool AnalyzeCode(const Function& function, std::vector<DecodedInstruction>& code, std::vector<RegisterUsage>& usage)
+{
+    DecodeAll<Layout>(function.instructions, code);
+    usage.resize(code.size());
+    for (size_t pc = 0; pc < code.size(); )
+    {
+        if (code[pc].op == OP_INVALID) {
+            return false;
+        }
+        AnalyzeInstruction<Layout>(function, code, (int)pc, usage[pc]);
+        for (int j = 1; j < usage[pc].length && pc + j < code.size(); j++)
+        {
+            usage[pc + j] = RegisterUsage();
+            usage[pc + j].length = 0;
+            usage[pc + j].nSuccessors = 0;
+        }
+        pc += usage[pc].length;
+    }
+    return true;
+}
+
+static inline bool IsJump(OpCode op)
+{
+    return op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP || op == OP_TFORPREP;
+}
+
+//
+// Editing. Jumps, line info and the ranges of the locals follow the code.
+//
+
+// An instruction to insert before position pc
+struct Insertion
+{
+    int         pc;
+    Instruction instruction;
+};
+
+// Inserts instructions before the positions they name, which must be in
+// ascending order, in one pass; instructions for the same position keep their
+// order and jumps to that position reach the first of them. The instruction
+// before such a position must not skip over it.
+template <typename Layout>
+void InsertInstructions(Function& function, const std::vector<Insertion>& insertions)
+{
+    if (insertions.empty()) {
+        return;
+    }
+
+    std::vector<DecodedInstruction> code;
+    std::vector<RegisterUsage>      usage;
+    AnalyzeCode<Layout>(function, code, usage);
+
+    // Number of instructions inserted before every position, not counting
+    // those inserted at the position itself
+    const int nCode = (int)code.size();
+    std::vector<int> inserted(nCode + 2, 0);
+    for (size_t j = 0; j < insertions.size(); j++) {
+        inserted[insertions[j].pc + 1]++;
+    }
+    for (int pc = 1; pc <= nCode + 1; pc++) {
+        inserted[pc] += inserted[pc - 1];
+    }
+    auto before = [&](int pc) { return inserted[std::max(0, std::min(pc, nCode + 1))]; };
+
+    for (int q = 0; q < nCode; q += std::max(usage[q].length, 1))
+    {
+        if (IsJump(code[q].op))
+        {
+            const int target = q + 1 + code[q].sbx;
+            const int from   = q + before(q + 1);
+            const int to     = target + before(target);
+            function.instructions[q] = Layout::SetBx(function.instructions[q], to - from - 1 + Layout::MAXARG_sBx);
+        }
+    }
+
+    std::vector<Instruction> instructions;
+    std::vector<Line>        lines;
+    instructions.reserve(function.instructions.size() + insertions.size());
+    lines.reserve(function.lines.empty() ? 0 : function.lines.size() + insertions.size());
+    for (size_t pc = 0, j = 0; pc <= function.instructions.size(); pc++)
+    {
+        for (; j < insertions.size() && insertions[j].pc == (int)pc; j++)
+        {
+            instructions.push_back(insertions[j].instruction);
+            if (!function.lines.empty()) {
+                lines.push_back(function.lines[std::min(pc, function.lines.size() - 1)]);
+            }
+        }
+        if (pc < function.instructions.size()) {
+            instructions.push_back(function.instructions[pc]);
+        }
+        if (pc < function.lines.size()) {
+            lines.push_back(function.lines[pc]);
+        }
+    }
+    function.instructions.swap(instructions);
+    function.lines.swap(lines);
+
+    for (size_t i = 0; i < function.locals.size(); i++)
+    {
+        Local& local = function.locals[i];
+        local.startPC += before(local.startPC + 1);
+        local.endPC   += before(local.endPC);
+    }
+}
+
+// Removes the instruction at position pc; jumps to pc reach the instruction
+// that follows it. No instruction may skip over pc.
+template <typename Layout>
+void RemoveInstruction(Function& function, int pc)
+{
+    std::vector<DecodedInstruction> code;
+    std::vector<RegisterUsage>      usage;
+    AnalyzeCode<Layout>(function, code, usage);
+
+    for (int q = 0; q < (int)code.size(); q += std::max(usage[q].length, 1))
+    {
+        if (q != pc && IsJump(code[q].op))
+        {
+            const int target = q + 1 + code[q].sbx;
+            const int from   = (q > pc)      ? q - 1      : q;
+            const int to     = (target > pc) ? target - 1 : target;
+            function.instructions[q] = Layout::SetBx(function.instructions[q], to - from - 1 + Layout::MAXARG_sBx);
+        }
+    }
+
+    if ((size_t)pc < function.lines.size()) {
+        function.lines.erase(function.lines.begin() + pc);
+    }
+    function.instructions.erase(function.instructions.begin() + pc);
+
+    for (size_t i = 0; i < function.locals.size(); i++)
+    {
+        Local& local = function.locals[i];
+        if (local.startPC > pc) {
+            local.startPC--;
+        }
+        if (local.endPC > pc) {
+            local.endPC--;
+        }
+    }
+}
+
+// Computes the registers that are live before and after every instruction
+void ComputeLiveness(const std::vector<RegisterUsage>& usage, std::vector<RegisterSet>& liveIn, std::vector<RegisterSet>& liveOut);
+
+// Returns the register of every entry of the debug info's locals. Locals are
+// not stored with their register; the active locals occupy the lowest
+// registers in the order they were declared.
+void GetLocalRegisters(const Function& function, std::vector<int>& registers);
+
+}
+#endif
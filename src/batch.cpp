@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include "batch.h"
+#include "formats.h"
+#include "lua_io.h"
+#include "corpus.h"
+#include "hash.h"
+#include "exceptions.h"
+#include "trace.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace Lua {
+
+static uint64_t HashData(const string& data)
+{
+    Hash hash;
+    hash.Add(data.data(), data.size());
+    return hash.Value();
+}
+
+struct ShardFile
+{
+    size_t    index;
+    uintmax_t size;
+    uint64_t  pathHash;
+
+    // Largest first, then by path hash and name so the order is total
+    bool operator<(const ShardFile& other) const
+    {
+        if (size != other.size) {
+            return size > other.size;
+        }
+        if (pathHash != other.pathHash) {
+            return pathHash < other.pathHash;
+        }
+        return index < other.index;
+    }
+};
+
+void GetShard(const string& root, const vector<string>& files, int shard, int nShards, vector<string>& shardFiles)
+{
+    vector<ShardFile> sorted(files.size());
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        error_code error;
+        Hash       hash;
+        hash.Add(files[i]);
+        sorted[i].index    = i;
+        sorted[i].size     = fs::file_size(GetFilePath(root, files[i]), error);
+        sorted[i].pathHash = hash.Value();
+        if (error) {
+            sorted[i].size = 0;
+        }
+    }
+    sort(sorted.begin(), sorted.end());
+
+    // Longest processing time first; the lowest shard wins ties
+    vector<uintmax_t> loads(nShards, 0);
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        const int target = (int)(min_element(loads.begin(), loads.end()) - loads.begin());
+        loads[target] += sorted[i].size;
+        if (target == shard) {
+            shardFiles.push_back(files[sorted[i].index]);
+        }
+    }
+    sort(shardFiles.begin(), shardFiles.end());
+}
+
+static void ConvertFile(const string& root, const string& dest, const PrepareFunction& prepare, ManifestEntry& entry)
+{
+    TraceSpan span("convert", entry.file.c_str());
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    ifstream input(GetFilePath(root, entry.file), ios_base::binary | ios_base::in);
+    if (!input.is_open()) {
+        throw FileNotFoundException();
+    }
+    const string data((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+    input.close();
+
+    MemoryStreamBuf buffer(data);
+    istream         stream(&buffer);
+    File            file;
+    entry.version = ReadAnyFile(stream, file);
+    if (entry.version == LUA_UNKNOWN) {
+        throw IOException("not a supported Lua file");
+    }
+    prepare(file, entry.version);
+
+    ostringstream converted;
+    LuaFormats[entry.version].output->Save(converted, file);
+    const string result = converted.str();
+
+    const fs::path path = fs::u8path(dest) / fs::u8path(entry.file);
+    error_code error;
+    fs::create_directories(path.parent_path(), error);
+    ofstream output(path, ios_base::binary | ios_base::out);
+    if (!output.is_open()) {
+        throw IOException("Unable to open output file");
+    }
+    output.write(result.data(), (streamsize)result.size());
+    output.close();
+    if (output.fail()) {
+        throw IOException("Unable to write file");
+    }
+
+    entry.inputHash    = HashData(data);
+    entry.inputSize    = data.size();
+    entry.outputHash   = HashData(result);
+    entry.outputSize   = result.size();
+    entry.microseconds = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+void RunBatch(const string& root, const string& dest, int shard, int nShards, const PrepareFunction& prepare,
+              vector<ManifestEntry>& entries, vector<string>& errors)
+{
+    vector<string> files, shardFiles;
+    ListFiles(root, files);
+    GetShard(root, files, shard, nShards, shardFiles);
+
+    // Convert the files in parallel, each into its own slot
+    vector<ManifestEntry> converted(shardFiles.size());
+    vector<string>        failures(shardFiles.size());
+    ParallelFor(shardFiles.size(), [&](size_t i)
+    {
+        converted[i].file = shardFiles[i];
+        try
+        {
+            ConvertFile(root, dest, prepare, converted[i]);
+        }
+        catch (exception& e)
+        {
+            failures[i] = e.what();
+        }
+    });
+
+    for (size_t i = 0; i < shardFiles.size(); i++)
+    {
+        if (failures[i].empty()) {
+            entries.push_back(converted[i]);
+        } else {
+            errors.push_back(shardFiles[i] + ": " + failures[i]);
+        }
+    }
+}
+
+//
+// Manifests
+//
+
+void WriteManifest(ostream& output, const vector<ManifestEntry>& entries)
+{
+    output << "# file\tformat\tinput_hash\tinput_size\toutput_hash\toutput_size\ttime_us\n";
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const ManifestEntry& entry = entries[i];
+        output << entry.file << "\t" << VersionNames[entry.version] << "\t"
+               << hex << setfill('0') << setw(16) << entry.inputHash << dec << "\t" << entry.inputSize << "\t"
+               << hex << setfill('0') << setw(16) << entry.outputHash << dec << "\t" << entry.outputSize << "\t"
+               << fixed << setprecision(1) << entry.microseconds << defaultfloat << "\n";
+    }
+}
+
+void ReadManifest(istream& input, vector<ManifestEntry>& entries)
+{
+    string line;
+    while (getline(input, line))
+    {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        // The file name is the only field that may contain spaces
+        const size_t tab = line.find('\t');
+        if (tab == string::npos) {
+            throw BadFileException();
+        }
+
+        ManifestEntry entry;
+        string        version;
+        entry.file = line.substr(0, tab);
+        istringstream fields(line.substr(tab + 1));
+        if (!(fields >> version >> hex >> entry.inputHash >> dec >> entry.inputSize
+                               >> hex >> entry.outputHash >> dec >> entry.outputSize >> entry.microseconds)) {
+            throw BadFileException();
+        }
+
+        entry.version = LUA_UNKNOWN;
+        for (int i = 0; i < 4; i++)
+        {
+            if (version == VersionNames[i]) {
+                entry.version = (Version)i;
+            }
+        }
+        if (entry.version == LUA_UNKNOWN) {
+            throw BadFileException();
+        }
+        entries.push_back(entry);
+    }
+}
+
+void MergeManifests(vector<ManifestEntry>& entries)
+{
+    sort(entries.begin(), entries.end(), [](const ManifestEntry& a, const ManifestEntry& b) { return a.file < b.file; });
+    for (size_t i = 1; i < entries.size(); i++)
+    {
+        if (entries[i].file == entries[i - 1].file) {
+            throw IOException("\"" + entries[i].file + "\" appears in more than one manifest");
+        }
+    }
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef BATCH_H
+#define BATCH_H
+// Conversion of a whole corpus, optionally split into shards for several
+// machines, with a manifest of what was converted
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "lua.h"
+
+namespace Lua
+{
+
+struct ManifestEntry
+{
+    std::string file;
+    Version     version;
+    uint64_t    inputHash;
+    uintmax_t   inputSize;
+    uint64_t    outputHash;
+    uintmax_t   outputSize;
+    double      microseconds;
+};
+
+// Called on every loaded file before it is saved in its converted format
+typedef std::function<void(File& file, Version version)> PrepareFunction;
+
+// Picks the files of shard 'shard' (zero-based) of 'nShards'. The files are
+// dealt out largest first, each to the shard with the fewest bytes so far,
+// with ties between equal sizes broken by a hash of the path. The result
+// only depends on the names and sizes, so every machine that sees the same
+// corpus picks the same shards.
+void GetShard(const std::string& root, const std::vector<std::string>& files, int shard, int nShards, std::vector<std::string>& shardFiles);
+
+// Converts the files of a shard of root in parallel into the same paths
+// below dest and describes every converted file in entries, sorted by name.
+// Files that cannot be converted are skipped and described in errors.
+void RunBatch(const std::string& root, const std::string& dest, int shard, int nShards, const PrepareFunction& prepare,
+              std::vector<ManifestEntry>& entries, std::vector<std::string>& errors);
+
+// Manifests are a tab-separated line per file
+void WriteManifest(std::ostream& output, const std::vector<ManifestEntry>& entries);
+void ReadManifest(std::istream& input, std::vector<ManifestEntry>& entries);
+
+// Sorts the entries of several manifests by name. Throws an IOException
+// naming the file if a file appears more than once.
+void MergeManifests(std::vector<ManifestEntry>& entries);
+
+}
+#endif
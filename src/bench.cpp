@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#include "allocations.h"
+#include "bench.h"
+#include "formats.h"
+#include "lua_io.h"
+#include "corpus.h"
+#include "exceptions.h"
+using namespace std;
+
+namespace Lua {
+
+// Names of the LuaFormats entries, indexed by Version
+static const char* PairNames[] = {"lua50-eaw", "lua51-uaw", "eaw-lua50", "uaw-lua51"};
+
+static double GetPeakRssKb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters)) {
+        return counters.PeakWorkingSetSize / 1024.0;
+    }
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return (double)usage.ru_maxrss;
+    }
+#endif
+    return 0;
+}
+
+struct Sample
+{
+    double microseconds;
+    double allocations;
+};
+
+struct Samples
+{
+    vector<Sample> samples;
+    double         bytes;
+    int            files;
+
+    Samples() : bytes(0), files(0) {}
+};
+
+// Converts a file in memory and returns its version
+static Version ConvertFile(const string& data, Sample& sample)
+{
+    AllocationCounter counter;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // Reading from memory keeps the copy of the file out of the timing
+    MemoryStreamBuf buffer(data);
+    istream         input(&buffer);
+    File            file;
+    Version         version = ReadAnyFile(input, file);
+    if (version != LUA_UNKNOWN)
+    {
+        ostringstream output;
+        LuaFormats[version].output->Save(output, file);
+    }
+
+    sample.microseconds = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    sample.allocations  = (double)counter.Count();
+    return version;
+}
+
+// Nearest-rank percentile
+static double GetPercentile(vector<double>& values, double percentile)
+{
+    sort(values.begin(), values.end());
+    const size_t rank = (size_t)ceil(percentile * values.size());
+    return values[max<size_t>(rank, 1) - 1];
+}
+
+static void AddResults(const string& name, const Samples& samples, BenchmarkResult& result)
+{
+    if (samples.samples.empty()) {
+        return;
+    }
+
+    vector<double> times;
+    double totalTime = 0, totalAllocations = 0;
+    for (size_t i = 0; i < samples.samples.size(); i++)
+    {
+        times.push_back(samples.samples[i].microseconds);
+        totalTime        += samples.samples[i].microseconds;
+        totalAllocations += samples.samples[i].allocations;
+    }
+
+    result[name + ".files"]           = samples.files;
+    result[name + ".p50_us"]          = GetPercentile(times, 0.50);
+    result[name + ".p99_us"]          = GetPercentile(times, 0.99);
+    result[name + ".mb_per_s"]        = (totalTime > 0) ? samples.bytes / totalTime : 0;   // bytes per us = MB per s
+    if (g_CountsAllocations) {
+        result[name + ".allocs_per_file"] = totalAllocations / samples.samples.size();
+    }
+}
+
+void RunBenchmark(const string& root, int iterations, BenchmarkResult& result, vector<string>& errors)
+{
+    vector<string> files;
+    ListFiles(root, files);
+
+    // Read everything up front so the disk is not part of the measurement,
+    // and convert every file once to find its pair and skip bad files
+    vector<string>  contents;
+    vector<Version> versions;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        try
+        {
+            ifstream input(GetFilePath(root, files[i]), ios_base::binary | ios_base::in);
+            if (!input.is_open()) {
+                throw FileNotFoundException();
+            }
+            string data((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+
+            Sample  sample;
+            Version version = ConvertFile(data, sample);
+            if (version == LUA_UNKNOWN) {
+                errors.push_back(files[i] + ": not a supported Lua file");
+                continue;
+            }
+            contents.push_back(data);
+            versions.push_back(version);
+        }
+        catch (exception& e)
+        {
+            errors.push_back(files[i] + ": " + e.what());
+        }
+    }
+
+    Samples pairs[4], total;
+    for (size_t i = 0; i < contents.size(); i++)
+    {
+        pairs[versions[i]].files++;
+        total.files++;
+    }
+
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (size_t i = 0; i < contents.size(); i++)
+        {
+            Sample sample;
+            ConvertFile(contents[i], sample);
+
+            pairs[versions[i]].samples.push_back(sample);
+            pairs[versions[i]].bytes += contents[i].size();
+            total.samples.push_back(sample);
+            total.bytes += contents[i].size();
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        AddResults(PairNames[i], pairs[i], result);
+    }
+    AddResults("total", total, result);
+    result["peak_rss_kb"] = GetPeakRssKb();
+}
+
+//
+// Result files are JSON with one object per pair
+//
+
+void WriteBenchmark(ostream& output, const BenchmarkResult& result)
+{
+    output << "{";
+    string group;
+    bool   first = true;
+    for (BenchmarkResult::const_iterator p = result.begin(); p != result.end(); ++p)
+    {
+        const size_t dot = p->first.find('.');
+        const string name = (dot == string::npos) ? p->first : p->first.substr(dot + 1);
+        const string next = (dot == string::npos) ? "" : p->first.substr(0, dot);
+
+        if (next != group)
+        {
+            if (!group.empty()) {
+                output << endl << "  }";
+                first = false;
+            }
+            if (!next.empty()) {
+                output << (first ? "" : ",") << endl << "  \"" << next << "\": {";
+                first = true;
+            }
+            group = next;
+        }
+
+        output << (first ? "" : ",") << endl << (group.empty() ? "  " : "    ") << "\"" << name << "\": " << p->second;
+        first = false;
+    }
+    if (!group.empty()) {
+        output << endl << "  }";
+    }
+    output << endl << "}" << endl;
+}
+
+static void SkipSpace(istream& input)
+{
+    while (isspace(input.peek())) {
+        input.get();
+    }
+}
+
+static void Expect(istream& input, char c)
+{
+    SkipSpace(input);
+    if (input.get() != c) {
+        throw BadFileException();
+    }
+}
+
+static string ReadJsonString(istream& input)
+{
+    Expect(input, '"');
+    string str;
+    for (int c; (c = input.get()) != '"'; )
+    {
+        if (c == EOF) {
+            throw BadFileException();
+        }
+        if (c == '\\') {
+            c = input.get();
+        }
+        str += (char)c;
+    }
+    return str;
+}
+
+// Reads an object of numbers and objects, naming nested values "<key>.<key>"
+static void ReadJsonObject(istream& input, const string& prefix, BenchmarkResult& result)
+{
+    Expect(input, '{');
+    SkipSpace(input);
+    if (input.peek() == '}') {
+        input.get();
+        return;
+    }
+
+    do
+    {
+        const string key = prefix + ReadJsonString(input);
+        Expect(input, ':');
+        SkipSpace(input);
+        if (input.peek() == '{') {
+            ReadJsonObject(input, key + ".", result);
+        } else if (!(input >> result[key])) {
+            throw BadFileException();
+        }
+        SkipSpace(input);
+    } while (input.get() == ',');
+
+    input.unget();
+    Expect(input, '}');
+}
+
+void ReadBenchmark(istream& input, BenchmarkResult& result)
+{
+    ReadJsonObject(input, "", result);
+}
+
+// The compared metrics and whether a higher value is better
+static const struct {
+    const char* name;
+    bool        higherIsBetter;
+} Metrics[] = {
+    {"p50_us",          false},
+    {"p99_us",          false},
+    {"mb_per_s",        true},
+    {"allocs_per_file", false},
+    {"peak_rss_kb",     false},
+    {NULL,              false}
+};
+
+void CompareBenchmarks(const BenchmarkResult& baseline, const BenchmarkResult& current, double threshold, vector<Regression>& regressions)
+{
+    for (BenchmarkResult::const_iterator p = current.begin(); p != current.end(); ++p)
+    {
+        BenchmarkResult::const_iterator base = baseline.find(p->first);
+        if (base == baseline.end() || base->second <= 0) {
+            continue;
+        }
+
+        const size_t dot  = p->first.rfind('.');
+        const string name = (dot == string::npos) ? p->first : p->first.substr(dot + 1);
+        for (int i = 0; Metrics[i].name != NULL; i++)
+        {
+            if (name == Metrics[i].name)
+            {
+                const double change = (p->second - base->second) / base->second;
+                if (Metrics[i].higherIsBetter ? change < -threshold : change > threshold)
+                {
+                    Regression regression;
+                    regression.metric   = p->first;
+                    regression.baseline = base->second;
+                    regression.current  = p->second;
+                    regressions.push_back(regression);
+                }
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+// End-to-end benchmark that replays a corpus through detection, loading and
+// saving
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Lua
+{
+
+// Measurements by name. Names are "<pair>.<metric>" for each format pair and
+// "total.<metric>" over all files, plus "peak_rss_kb" for the process. The
+// peak includes the whole corpus, which is kept in memory, so it only shows
+// conversion memory when the corpus is small compared to it.
+typedef std::map<std::string, double> BenchmarkResult;
+
+struct Regression
+{
+    std::string metric;
+    double      baseline;
+    double      current;
+};
+
+// Loads every file below root into memory, then converts each of them
+// 'iterations' times on one thread, timing every conversion and, in builds
+// that count allocations, counting its allocations. Files that cannot be converted are skipped and described
+// in errors.
+void RunBenchmark(const std::string& root, int iterations, BenchmarkResult& result, std::vector<std::string>& errors);
+
+void WriteBenchmark(std::ostream& output, const BenchmarkResult& result);
+void ReadBenchmark(std::istream& input, BenchmarkResult& result);
+
+// Returns the metrics that are worse than the baseline by more than the
+// threshold, a fraction of the baseline value
+void CompareBenchmarks(const BenchmarkResult& baseline, const BenchmarkResult& current, double threshold, std::vector<Regression>& regressions);
+
+}
+#endif
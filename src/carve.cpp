@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "carve.h"
+#include "formats.h"
+#include "lua_io.h"
+#include "corpus.h"
+#include "exceptions.h"
+#include "trace.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace Lua {
+
+// A read-only view of a whole file. The pages are only read from disk as
+// the scan reaches them, so files larger than memory can be carved.
+class MappedFile
+{
+    const char* m_data;
+    size_t      m_size;
+#ifdef _WIN32
+    HANDLE      m_file;
+    HANDLE      m_mapping;
+#endif
+
+public:
+    const char* Data() const { return m_data; }
+    size_t      Size() const { return m_size; }
+
+    MappedFile(const fs::path& path);
+    ~MappedFile();
+};
+
+#ifdef _WIN32
+MappedFile::MappedFile(const fs::path& path)
+    : m_data(NULL), m_size(0), m_mapping(NULL)
+{
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        throw FileNotFoundException();
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || (unsigned long long)size.QuadPart > SIZE_MAX)
+    {
+        CloseHandle(m_file);
+        throw IOException("Unable to map file");
+    }
+    m_size = (size_t)size.QuadPart;
+
+    // Empty files cannot be mapped
+    if (m_size > 0)
+    {
+        m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        m_data    = (m_mapping != NULL) ? (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (m_data == NULL)
+        {
+            if (m_mapping != NULL) {
+                CloseHandle(m_mapping);
+            }
+            CloseHandle(m_file);
+            throw IOException("Unable to map file");
+        }
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != NULL)
+    {
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping);
+    }
+    CloseHandle(m_file);
+}
+#else
+MappedFile::MappedFile(const fs::path& path)
+    : m_data(NULL), m_size(0)
+{
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw FileNotFoundException();
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0)
+    {
+        close(file);
+        throw IOException("Unable to map file");
+    }
+    m_size = (size_t)info.st_size;
+
+    // Empty files cannot be mapped
+    if (m_size > 0)
+    {
+        void* data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (data == MAP_FAILED)
+        {
+            close(file);
+            throw IOException("Unable to map file");
+        }
+        m_data = (const char*)data;
+    }
+    close(file);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != NULL) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+}
+#endif
+
+//
+// Signature search
+//
+
+// Every thread scans blocks of this size; signatures may cross their end
+static const size_t SCAN_BLOCK_SIZE = 16 << 20;
+
+static void CheckSignature(const char* data, size_t size, size_t offset, vector<uint64_t>& offsets)
+{
+    if (size - offset >= 4 && memcmp(data + offset, "\033Lu", 3) == 0 && (data[offset + 3] == 'a' || data[offset + 3] == 'p')) {
+        offsets.push_back(offset);
+    }
+}
+
+// Finds the signatures that start in [first, last)
+static void FindSignatures(const char* data, size_t size, size_t first, size_t last, vector<uint64_t>& offsets)
+{
+    size_t i = first;
+#ifdef HAVE_SSE2
+    // Compare 64 bytes at a time against the escape that starts every
+    // signature; only blocks that hold one are looked at more closely
+    const __m128i escape = _mm_set1_epi8('\033');
+    for (; last - i >= 64; i += 64)
+    {
+        const __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)),      escape);
+        const __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 16)), escape);
+        const __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 32)), escape);
+        const __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i + 48)), escape);
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) == 0) {
+            continue;
+        }
+
+        uint64_t mask = (uint64_t)_mm_movemask_epi8(a)
+                      | (uint64_t)_mm_movemask_epi8(b) << 16
+                      | (uint64_t)_mm_movemask_epi8(c) << 32
+                      | (uint64_t)_mm_movemask_epi8(d) << 48;
+        for (size_t j = 0; mask != 0; j++, mask >>= 1)
+        {
+            if (mask & 1) {
+                CheckSignature(data, size, i + j, offsets);
+            }
+        }
+    }
+#endif
+    while (i < last)
+    {
+        const char* escape = (const char*)memchr(data + i, '\033', last - i);
+        if (escape == NULL) {
+            break;
+        }
+        i = escape - data;
+        CheckSignature(data, size, i++, offsets);
+    }
+}
+
+void FindSignatures(const char* data, size_t size, vector<uint64_t>& offsets)
+{
+    TraceSpan span("find signatures");
+
+    const size_t nBlocks = (size + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+    vector<vector<uint64_t> > blocks(nBlocks);
+    ParallelFor(nBlocks, [&](size_t i)
+    {
+        const size_t first = i * SCAN_BLOCK_SIZE;
+        FindSignatures(data, size, first, min(size, first + SCAN_BLOCK_SIZE), blocks[i]);
+    });
+
+    for (size_t i = 0; i < nBlocks; i++) {
+        offsets.insert(offsets.end(), blocks[i].begin(), blocks[i].end());
+    }
+}
+
+//
+// Chunks
+//
+
+// Returns the size of the chunk at the start of the data, or 0 if there is
+// none. The reader never reads past the end of the data, counts that do not
+// fit in it are rejected, and arrays only grow past the size of the data as
+// their elements are read. Any failure to load means there is no chunk.
+static size_t GetChunkSize(const char* data, size_t size, Version& version, File& file)
+{
+    version = DetectFileVersion(data, size);
+    if (version == LUA_UNKNOWN) {
+        return 0;
+    }
+
+    // Loading validates the header before it reads anything else
+    try
+    {
+        MemoryStreamBuf buffer(data, size);
+        istream         input(&buffer);
+        LuaFormats[version].input->Load(input, file);
+        return (size_t)input.tellg();
+    }
+    catch (exception&)
+    {
+        return 0;
+    }
+}
+
+void FindChunks(const char* data, size_t size, vector<CarvedChunk>& chunks)
+{
+    vector<uint64_t> offsets;
+    FindSignatures(data, size, offsets);
+
+    // Most signatures are false positives that are rejected by the header
+    // check, so every candidate is tried independently
+    vector<CarvedChunk> candidates(offsets.size());
+    {
+        TraceSpan span("load chunks");
+        ParallelFor(offsets.size(), [&](size_t i)
+        {
+            File file;
+            candidates[i].offset = offsets[i];
+            candidates[i].size   = GetChunkSize(data + offsets[i], size - offsets[i], candidates[i].version, file);
+        });
+    }
+
+    uint64_t end = 0;
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        if (candidates[i].size > 0 && candidates[i].offset >= end)
+        {
+            chunks.push_back(candidates[i]);
+            end = candidates[i].offset + candidates[i].size;
+        }
+    }
+}
+
+static string GetChunkName(uint64_t offset, const LuaFormat& format)
+{
+    ostringstream name;
+    name << hex << setfill('0') << setw(8) << offset << format.Extension();
+    return name.str();
+}
+
+// Writes the chunk as it is, or converted if there is a prepare function
+static void WriteChunk(const char* data, const string& dest, const PrepareFunction* prepare, const CarvedChunk& chunk)
+{
+    string converted;
+    if (prepare != NULL)
+    {
+        MemoryStreamBuf buffer(data + chunk.offset, (size_t)chunk.size);
+        istream         input(&buffer);
+        File            file;
+        LuaFormats[chunk.version].input->Load(input, file);
+        (*prepare)(file, chunk.version);
+
+        ostringstream output(ios_base::out | ios_base::binary);
+        LuaFormats[chunk.version].output->Save(output, file);
+        converted = output.str();
+    }
+
+    ofstream output(fs::u8path(dest) / fs::u8path(chunk.file), ios_base::binary | ios_base::out);
+    if (!output.is_open()) {
+        throw IOException("Unable to open output file");
+    }
+    if (prepare == NULL) {
+        output.write(data + chunk.offset, (streamsize)chunk.size);
+    } else {
+        output.write(converted.data(), (streamsize)converted.size());
+    }
+    output.close();
+    if (output.fail()) {
+        throw IOException("Unable to write file");
+    }
+}
+
+void CarveFile(const string& path, const string& dest, const PrepareFunction* prepare, vector<CarvedChunk>& chunks, vector<string>& errors)
+{
+    MappedFile mapped(fs::u8path(path));
+    vector<CarvedChunk> found;
+    FindChunks(mapped.Data(), mapped.Size(), found);
+
+    fs::create_directories(fs::u8path(dest));
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        CarvedChunk& chunk = found[i];
+        const FormatPair& formats = LuaFormats[chunk.version];
+        chunk.file = GetChunkName(chunk.offset, (prepare != NULL) ? *formats.output : *formats.input);
+
+        TraceSpan span("write chunk", chunk.file.c_str());
+        try
+        {
+            WriteChunk(mapped.Data(), dest, prepare, chunk);
+            chunks.push_back(chunk);
+        }
+        catch (exception& e)
+        {
+            errors.push_back(chunk.file + ": " + e.what());
+        }
+    }
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef CARVE_H
+#define CARVE_H
+// Recovery of compiled chunks embedded in other files, like save games,
+// memory dumps and resource archives
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "batch.h"
+
+namespace Lua
+{
+
+struct CarvedChunk
+{
+    uint64_t    offset;
+    uint64_t    size;
+    Version     version;
+    std::string file;       // name of the extracted file, relative to dest
+};
+
+// Finds the offset of every "\033Lua" and "\033Lup" in the data, in order,
+// scanning parts of the data on all hardware threads
+void FindSignatures(const char* data, size_t size, std::vector<uint64_t>& offsets);
+
+// Returns the chunks that start at a signature, have a valid header and load
+// completely without running past the end of the data. A signature inside an
+// earlier chunk does not start another chunk.
+void FindChunks(const char* data, size_t size, std::vector<CarvedChunk>& chunks);
+
+// Maps the file into memory, finds its chunks and writes each of them into
+// dest, named after its offset and with the extension of the format it is
+// written in. Without a prepare function the chunks are extracted as they
+// are; otherwise they are converted, calling prepare first. The chunks that
+// were written are returned in chunks; those that could not be converted or
+// written are skipped and described in errors.
+void CarveFile(const std::string& path, const std::string& dest, const PrepareFunction* prepare,
+               std::vector<CarvedChunk>& chunks, std::vector<std::string>& errors);
+
+}
+#endif
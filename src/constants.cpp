@@ -0,0 +1,253 @@
+#include <algorithm>
+#include "analysis.h"
+#include "trace.h"
+using namespace std;
+
+namespace Lua {
+
+//
+// Constant reordering
+//
+// Instructions can only name the first constants of a function directly as an
+// RK operand; any other constant has to be loaded into a register with a
+// LOADK first. A LOADK whose register is only read by an RK operand of the
+// next instruction can be folded into that instruction if its constant is in
+// range. The constants that such folds need are moved to the front of the
+// table, behind the ones that RK operands already name, after which every
+// constant operand is renumbered and the LOADKs are folded.
+//
+
+// The RK operands of an instruction that a load folds into
+enum { FOLD_B = 1, FOLD_C = 2 };
+
+// Returns the RK operands of the instruction at pc that read register r, or 0
+// if there are none or it also reads r in another way
+template <typename Layout>
+static int GetFoldOperands(const Function& function, vector<DecodedInstruction>& code, int pc, int r)
+{
+    RegisterUsage usage;
+    AnalyzeInstruction<Layout>(function, code, pc, usage);
+
+    DecodedInstruction& i = code[pc];
+    const int operands = ((usage.b == OPERAND_RK && i.b == r) ? FOLD_B : 0) |
+                         ((usage.c == OPERAND_RK && i.c == r) ? FOLD_C : 0);
+    if (operands == 0) {
+        return 0;
+    }
+
+    // Analyze it as if those operands named a constant instead
+    const DecodedInstruction original = i;
+    if (operands & FOLD_B) i.b = Layout::RKConstant(0);
+    if (operands & FOLD_C) i.c = Layout::RKConstant(0);
+    AnalyzeInstruction<Layout>(function, code, pc, usage);
+    i = original;
+    return usage.reads.test(r) ? 0 : operands;
+}
+
+// Returns the positions of the LOADKs that can be folded into the next
+// instruction if their constant were in range, and the operands they fold into
+template <typename Layout>
+static void FindFoldableLoads(const Function& function, vector<pair<int, int> >& loads)
+{
+    vector<DecodedInstruction> code;
+    vector<RegisterUsage>      usage;
+    if (!AnalyzeCode<Layout>(function, code, usage)) {
+        return;
+    }
+
+    const int nCode = (int)code.size();
+    vector<RegisterSet> liveIn, liveOut;
+    ComputeLiveness(usage, liveIn, liveOut);
+
+    // Instructions that are reached other than from the one before them
+    vector<bool> joins(nCode + 1, false);
+    for (int pc = 0; pc < nCode; pc++)
+    {
+        for (int j = 0; j < usage[pc].nSuccessors; j++)
+        {
+            const int next = usage[pc].successors[j];
+            if (next != pc + max(usage[pc].length, 1) && next >= 0 && next <= nCode) {
+                joins[next] = true;
+            }
+        }
+    }
+
+    // Locals must keep the instruction that gives them their value
+    vector<int> localRegisters;
+    GetLocalRegisters(function, localRegisters);
+
+    for (int pc = 0; pc + 1 < nCode; pc++)
+    {
+        const int r = code[pc].a;
+        if (code[pc].op != OP_LOADK || usage[pc].length != 1 || usage[pc + 1].length < 1 || joins[pc + 1]) {
+            continue;
+        }
+        if (liveOut[pc + 1].test(r) && !usage[pc + 1].writes.test(r)) {
+            continue;
+        }
+
+        bool isLocal = false;
+        for (size_t i = 0; i < localRegisters.size(); i++)
+        {
+            const Local& local = function.locals[i];
+            if (localRegisters[i] == r && local.startPC <= pc + 1 && pc + 1 < local.endPC) {
+                isLocal = true;
+            }
+        }
+
+        const int operands = isLocal ? 0 : GetFoldOperands<Layout>(function, code, pc + 1, r);
+        if (operands != 0) {
+            loads.push_back(make_pair(pc, operands));
+        }
+    }
+}
+
+// Gives the constants that Bx and RK operands name their new index
+template <typename Layout>
+static void RenumberConstants(Function& function, const vector<int>& renumber)
+{
+    vector<DecodedInstruction> code;
+    vector<RegisterUsage>      usage;
+    AnalyzeCode<Layout>(function, code, usage);
+
+    for (size_t pc = 0; pc < code.size(); pc += max(usage[pc].length, 1))
+    {
+        Instruction&              i = function.instructions[pc];
+        const DecodedInstruction& d = code[pc];
+        switch (d.op)
+        {
+            case OP_LOADK:
+            case OP_GETGLOBAL:
+            case OP_SETGLOBAL:
+                i = Layout::SetBx(i, renumber[d.bx]);
+                break;
+
+            default:
+                if (usage[pc].b == OPERAND_RK && Layout::IsConstant(d.b)) {
+                    i = Layout::SetB(i, Layout::RKConstant(renumber[Layout::ConstantIndex(d.b)]));
+                }
+                if (usage[pc].c == OPERAND_RK && Layout::IsConstant(d.c)) {
+                    i = Layout::SetC(i, Layout::RKConstant(renumber[Layout::ConstantIndex(d.c)]));
+                }
+                break;
+        }
+    }
+}
+
+// Moves the constants that RK operands name or that foldable LOADKs load to
+// the front if any of them is out of range
+template <typename Layout>
+static void ReorderFunctionConstants(Function& function, const vector<pair<int, int> >& loads)
+{
+    vector<DecodedInstruction> code;
+    vector<RegisterUsage>      usage;
+    if (!AnalyzeCode<Layout>(function, code, usage)) {
+        return;
+    }
+
+    const int nConstants = (int)function.constants.size();
+    vector<bool> named(nConstants, false);
+    vector<int>  folds(nConstants, 0);
+    for (size_t pc = 0; pc < code.size(); pc += max(usage[pc].length, 1))
+    {
+        if (usage[pc].b == OPERAND_RK && Layout::IsConstant(code[pc].b)) {
+            named[Layout::ConstantIndex(code[pc].b)] = true;
+        }
+        if (usage[pc].c == OPERAND_RK && Layout::IsConstant(code[pc].c)) {
+            named[Layout::ConstantIndex(code[pc].c)] = true;
+        }
+    }
+    for (size_t i = 0; i < loads.size(); i++)
+    {
+        if (code[loads[i].first].bx < nConstants) {
+            folds[code[loads[i].first].bx]++;
+        }
+    }
+
+    bool outOfRange = false;
+    for (int k = Layout::MAXINDEXRK + 1; k < nConstants; k++) {
+        outOfRange |= (folds[k] > 0);
+    }
+    if (!outOfRange) {
+        return;
+    }
+
+    // The constants that RK operands name come first so they stay in range,
+    // then those with the most folds. The order is stable otherwise.
+    vector<int> order(nConstants);
+    for (int k = 0; k < nConstants; k++) {
+        order[k] = k;
+    }
+    stable_sort(order.begin(), order.end(), [&](int a, int b) -> bool
+    {
+        if (named[a] != named[b]) {
+            return named[a];
+        }
+        return folds[a] > folds[b];
+    });
+
+    vector<int>      renumber(nConstants);
+    vector<Constant> constants(nConstants);
+    for (int k = 0; k < nConstants; k++)
+    {
+        renumber[order[k]] = k;
+        constants[k]       = function.constants[order[k]];
+    }
+    RenumberConstants<Layout>(function, renumber);
+    function.constants.swap(constants);
+}
+
+template <typename Layout>
+static void OptimizeFunctionConstants(Function& function)
+{
+    for (size_t i = 0; i < function.functions.size(); i++) {
+        OptimizeFunctionConstants<Layout>(function.functions[i]);
+    }
+
+    // Folding a load can make the one before it foldable, so repeat
+    for (bool changed = true; changed; )
+    {
+        vector<pair<int, int> > loads;
+        FindFoldableLoads<Layout>(function, loads);
+        ReorderFunctionConstants<Layout>(function, loads);
+
+        // Fold from the back, so the positions of the earlier loads stay valid
+        changed = false;
+        for (size_t j = loads.size(); j-- > 0; )
+        {
+            const int pc = loads[j].first;
+            const int k  = Layout::GetBx(function.instructions[pc]);
+            if (k > Layout::MAXINDEXRK) {
+                continue;
+            }
+
+            Instruction& next = function.instructions[pc + 1];
+            if (loads[j].second & FOLD_B) next = Layout::SetB(next, Layout::RKConstant(k));
+            if (loads[j].second & FOLD_C) next = Layout::SetC(next, Layout::RKConstant(k));
+            RemoveInstruction<Layout>(function, pc);
+            changed = true;
+        }
+    }
+}
+
+void ReorderConstants(File& file, Version version)
+{
+    TraceSpan span("reorder constants");
+    switch (version)
+    {
+        case LUA_50:
+        case LUA_EAW:
+            OptimizeFunctionConstants<Lua50::Layout>(file.function);
+            break;
+
+        case LUA_51:
+        case LUA_UAW:
+            OptimizeFunctionConstants<Lua51::Layout>(file.function);
+            break;
+
+        default:
+            break;
+    }
+}
+
+}
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include "corpus.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+void ListFiles(const string& root, vector<string>& files)
+{
+    const fs::path rootPath = fs::u8path(root);
+    if (fs::is_regular_file(rootPath))
+    {
+        files.push_back(rootPath.filename().generic_u8string());
+        return;
+    }
+
+    for (fs::recursive_directory_iterator p(rootPath), end; p != end; ++p)
+    {
+        if (p->is_regular_file()) {
+            files.push_back(p->path().lexically_relative(rootPath).generic_u8string());
+        }
+    }
+    sort(files.begin(), files.end());
+}
+
+fs::path GetFilePath(const string& root, const string& file)
+{
+    const fs::path rootPath = fs::u8path(root);
+    return fs::is_regular_file(rootPath) ? rootPath : rootPath / fs::u8path(file);
+}
+
+void ParallelFor(size_t count, const function<void(size_t)>& body)
+{
+    atomic<size_t>     next(0);
+    exception_ptr      error;
+    mutex              errorLock;
+
+    auto worker = [&]()
+    {
+        for (size_t i; (i = next++) < count; )
+        {
+            try
+            {
+                body(i);
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(errorLock);
+                if (!error) {
+                    error = current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+
+    size_t nThreads = min<size_t>(max(thread::hardware_concurrency(), 1u), count);
+    vector<thread> threads;
+    for (size_t i = 1; i < nThreads; i++) {
+        threads.push_back(thread(worker));
+    }
+    worker();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    if (error) {
+        rethrow_exception(error);
+    }
+}
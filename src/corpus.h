@@ -0,0 +1,23 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+// Helpers for processing a directory of files on all hardware threads
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Lists the regular files below root, recursively and sorted. The names are
+// relative to root, UTF-8 and use forward slashes. If root is a file, the
+// list holds just its name.
+void ListFiles(const std::string& root, std::vector<std::string>& files);
+
+// Returns the path of a listed file
+std::filesystem::path GetFilePath(const std::string& root, const std::string& file);
+
+// Calls body(i) for every i below count, spread over all hardware threads.
+// The first exception thrown by a call is rethrown when all threads are done;
+// bodies that want to continue past a bad file should catch their own.
+void ParallelFor(size_t count, const std::function<void(size_t)>& body);
+
+#endif
@@ -0,0 +1,96 @@
+#include "formats.h"
+#include "lua_io.h"
+#include "trace.h"
+#include "exceptions.h"
+using namespace std;
+
+namespace Lua {
+
+template <typename Format>
+class SpecificLuaFormat : public LuaFormat
+{
+    void Load(istream& input, File& file) const
+    {
+        Format::Codec::template ReadFile<Format>(input, file);
+    }
+    
+    void Save(ostream& output, const File& file) const
+    {
+        Format::Codec::template WriteFile<Format>(output, file);
+    }
+
+    void CheckHeader(istream& input) const
+    {
+        Format::Codec::template CheckHeader<Format>(input);
+    }
+
+    const char* Extension() const
+    {
+        return Format::Extension();
+    }
+
+public:
+    SpecificLuaFormat() {}
+};
+
+static const SpecificLuaFormat<FormatLua50>  g_FormatLua50;
+static const SpecificLuaFormat<FormatLua51>  g_FormatLua51;
+static const SpecificLuaFormat<FormatLupEaW> g_FormatLupEaW;
+static const SpecificLuaFormat<FormatLupUaW> g_FormatLupUaW;
+
+const FormatPair LuaFormats[] = {
+    {&g_FormatLua50,  &g_FormatLupEaW},
+    {&g_FormatLua51,  &g_FormatLupUaW},
+    {&g_FormatLupEaW, &g_FormatLua50},
+    {&g_FormatLupUaW, &g_FormatLua51},
+    {NULL, NULL}
+};
+
+const char* const VersionNames[] = {"lua50", "lua51", "eaw", "uaw"};
+
+Version ReadAnyFile(istream& input, File& file)
+{
+    // Peek at the header rather than seeking back, so pipes can be read too
+    char header[DETECT_SIZE];
+    input.read(header, sizeof header);
+    const size_t size = (size_t)input.gcount();
+
+    Version version;
+    {
+        TraceSpan span("detect");
+        version = DetectFileVersion(header, size);
+    }
+    if (version != LUA_UNKNOWN)
+    {
+        PeekedStreamBuf buffer(header, size, input.rdbuf());
+        istream stream(&buffer);
+        LuaFormats[version].input->Load(stream, file);
+    }
+    return version;
+}
+
+Version ReadAnyHeader(istream& input, bool& valid)
+{
+    char header[DETECT_SIZE];
+    input.read(header, sizeof header);
+    const size_t size = (size_t)input.gcount();
+
+    const Version version = DetectFileVersion(header, size);
+    valid = false;
+    if (version != LUA_UNKNOWN)
+    {
+        PeekedStreamBuf buffer(header, size, input.rdbuf());
+        istream stream(&buffer);
+        try
+        {
+            LuaFormats[version].input->CheckHeader(stream);
+            valid = true;
+        }
+        catch (IOException&)
+        {
+        }
+    }
+    return version;
+}
+
+}
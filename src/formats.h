@@ -0,0 +1,109 @@
+#ifndef FORMATS_H
+#define FORMATS_H
+// Compile-time description of the supported Lua and Petroglyph-Lua formats
+
+#include "lua.h"
+
+namespace Lua
+{
+
+//
+// Every format is a traits structure that names the codec which knows its
+// field order, the header fields that identify it, the extension of its
+// files, whether its functions carry the special Petroglyph integer and the
+// width of the numbers it writes.
+// The codecs are instantiated per format, so none of this is tested at
+// runtime. A new variant only needs a traits structure here and an explicit
+// instantiation next to its codec.
+//
+
+struct FormatLua50
+{
+    typedef Lua50::Codec Codec;
+    typedef double       Number;
+
+    static const char* Signature() { return "\033Lua"; }
+    static const char* Extension() { return ".lua"; }
+    static const unsigned char VersionByte = 0x50;
+    static const unsigned char FormatByte  = 0;
+    static const bool          HasPetroInt = false;
+};
+
+struct FormatLua51
+{
+    typedef Lua51::Codec Codec;
+    typedef float        Number;
+
+    static const char* Signature() { return "\033Lua"; }
+    static const char* Extension() { return ".lua"; }
+    static const unsigned char VersionByte = 0x51;
+    static const unsigned char FormatByte  = 0;
+    static const bool          HasPetroInt = false;
+};
+
+// Empire at War and Forces of Corruption
+struct FormatLupEaW
+{
+    typedef Lua50::Codec Codec;
+    typedef double       Number;
+
+    static const char* Signature() { return "\033Lup"; }
+    static const char* Extension() { return ".lup"; }
+    static const unsigned char VersionByte = 0x51;
+    static const unsigned char FormatByte  = 0;
+    static const bool          HasPetroInt = true;
+};
+
+// Universe at War
+struct FormatLupUaW
+{
+    typedef Lua51::Codec Codec;
+    typedef float        Number;
+
+    static const char* Signature() { return "\033Lua"; }
+    static const char* Extension() { return ".lua"; }
+    static const unsigned char VersionByte = 0x51;
+    static const unsigned char FormatByte  = 'p';
+    static const bool          HasPetroInt = true;
+};
+
+// Runtime access to a format; the one virtual call per file selects the
+// specialized codec
+class LuaFormat
+{
+public:
+    virtual void Load(std::istream& input, File& file) const = 0;
+    virtual void Save(std::ostream& output, const File& file) const = 0;
+
+    // Reads and validates just the header. Throws a BadFileException if it is
+    // not valid for this format.
+    virtual void CheckHeader(std::istream& input) const = 0;
+
+    // The extension of files in this format, including the dot
+    virtual const char* Extension() const = 0;
+};
+
+// For every Version, its own format and the format it is converted to
+struct FormatPair
+{
+    const LuaFormat* input;
+    const LuaFormat* output;
+};
+
+extern const FormatPair LuaFormats[];
+
+// Short names of the formats, indexed by Version, as they appear in
+// manifests and reports
+extern const char* const VersionNames[];
+
+// Detects the format of the stream and loads it.
+// Returns LUA_UNKNOWN without loading if the format is not recognized.
+Version ReadAnyFile(std::istream& input, File& file);
+
+// Detects the format of the stream and validates its header without reading
+// any further. Returns LUA_UNKNOWN if the format is not recognized; otherwise
+// valid tells whether the header is complete and valid for the format.
+Version ReadAnyHeader(std::istream& input, bool& valid);
+
+}
+#endif
@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include "analysis.h"
+#include "trace.h"
+using namespace std;
+
+namespace Lua {
+
+//
+// Global caching
+//
+// A loop is the code from the target of a backward jump up to the jump. A
+// global that a loop reads but never writes is loaded into a register of its
+// own right before the loop, and the reads in the loop become moves. The
+// registers for the cached globals are placed right above the parameters, so
+// that no call in a loop overwrites them; all other registers move up to make
+// room. The loads are only valid if nothing the loop calls assigns those
+// globals, which is why the pass is opt-in.
+//
+
+struct Loop
+{
+    int first;
+    int last;
+
+    bool operator<(const Loop& other) const { return last - first > other.last - other.first; }
+};
+
+struct CacheLoad
+{
+    int pc;         // the load goes before this instruction
+    int global;
+
+    bool operator<(const CacheLoad& other) const { return pc < other.pc || (pc == other.pc && global < other.global); }
+};
+
+static bool IsInLoop(const Loop& loop, int pc)
+{
+    return loop.first <= pc && pc <= loop.last;
+}
+
+// Returns whether the instruction can neither assign a global nor call
+// anything that could, through a metamethod or otherwise
+static bool IsInertEntry(OpCode op)
+{
+    switch (op)
+    {
+        case OP_MOVE:
+        case OP_LOADK:
+        case OP_LOADBOOL:
+        case OP_LOADNIL:
+        case OP_GETUPVAL:
+        case OP_NEWTABLE:
+        case OP_JMP:
+        case OP_FORPREP:
+        case OP_TFORPREP:
+        case OP_CLOSE:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+template <typename Layout>
+static void ShiftRegister(Instruction& i, OperandKind kind, int value, int base, int shift, Instruction (*set)(Instruction, int))
+{
+    if ((kind == OPERAND_REGISTER || kind == OPERAND_RANGE || (kind == OPERAND_RK && !Layout::IsConstant(value))) && value >= base) {
+        i = set(i, value + shift);
+    }
+}
+
+template <typename Layout>
+static void CacheFunctionGlobals(Function& function)
+{
+    for (size_t i = 0; i < function.functions.size(); i++) {
+        CacheFunctionGlobals<Layout>(function.functions[i]);
+    }
+
+    vector<DecodedInstruction> code;
+    vector<RegisterUsage>      usage;
+    if (!AnalyzeCode<Layout>(function, code, usage)) {
+        return;
+    }
+    const int nCode = (int)code.size();
+
+    vector<Loop> loops;
+    for (int pc = 0; pc < nCode; pc += max(usage[pc].length, 1))
+    {
+        const int target = pc + 1 + code[pc].sbx;
+        if (IsJump(code[pc].op) && target <= pc)
+        {
+            Loop loop = {target, pc};
+            loops.push_back(loop);
+        }
+    }
+    sort(loops.begin(), loops.end());
+
+    // Outer loops come first, so an inner loop only caches what its outer
+    // loop could not
+    map<string, int>  globals;
+    vector<int>       constants;    // constant of every cached global's name
+    vector<int>       rewrite(nCode, -1);
+    vector<CacheLoad> loads;
+    for (size_t l = 0; l < loops.size(); l++)
+    {
+        const Loop& loop  = loops[l];
+        const int   entry = loop.first - 1;
+
+        // The loads go before the one instruction that enters the loop, and
+        // that instruction must not be skipped by a test or run any code that
+        // could assign the globals after they were loaded
+        if (entry < 0 || usage[entry].length == 0 || !IsInertEntry(code[entry].op)) {
+            continue;
+        }
+        bool single = true;
+        for (int pc = 0; pc < nCode && single; pc += max(usage[pc].length, 1))
+        {
+            for (int s = 0; s < usage[pc].nSuccessors; s++)
+            {
+                const int next = usage[pc].successors[s];
+                if (!IsInLoop(loop, pc) && pc != entry && IsInLoop(loop, next)) {
+                    single = false;
+                }
+            }
+        }
+        if (!single) {
+            continue;
+        }
+
+        set<string> written;
+        for (int pc = loop.first; pc <= loop.last; pc += max(usage[pc].length, 1))
+        {
+            if (code[pc].op == OP_SETGLOBAL) {
+                written.insert(function.constants[code[pc].bx].str);
+            }
+        }
+
+        set<int> cached;
+        for (int pc = loop.first; pc <= loop.last; pc += max(usage[pc].length, 1))
+        {
+            if (code[pc].op == OP_GETGLOBAL && rewrite[pc] < 0)
+            {
+                const Constant& name = function.constants[code[pc].bx];
+                if (name.type == TSTRING && written.find(name.str) == written.end())
+                {
+                    pair<map<string,int>::iterator, bool> p = globals.insert(make_pair(name.str, (int)constants.size()));
+                    if (p.second) {
+                        constants.push_back(code[pc].bx);
+                    }
+                    rewrite[pc] = p.first->second;
+                    cached.insert(p.first->second);
+                }
+            }
+        }
+        for (set<int>::const_iterator p = cached.begin(); p != cached.end(); ++p)
+        {
+            CacheLoad load = {entry, *p};
+            loads.push_back(load);
+        }
+    }
+
+    const int base  = GetParameterRegisters<Layout>(function);
+    const int shift = (int)constants.size();
+    if (shift == 0 || function.maxStackSize + shift > Layout::MAXSTACK) {
+        return;
+    }
+
+    // No range may span the new registers and no instruction may overwrite
+    // registers on both sides of them, like a call on a parameter would
+    RegisterSet below;
+    AddRange(below, 0, base - 1);
+    for (int pc = 0; pc < nCode; pc += max(usage[pc].length, 1))
+    {
+        const RegisterSet defs = usage[pc].writes | usage[pc].clobbers;
+        if ((base > 0 && usage[pc].fixed.test(base - 1) && usage[pc].fixed.test(base)) ||
+            ((defs & below).any() && (defs & ~below).any())) {
+            return;
+        }
+    }
+
+    // Make room for the cached globals and turn the reads into moves
+    const int MOVE      = GetOpcodeNumber<Layout>(OP_MOVE);
+    const int GETGLOBAL = GetOpcodeNumber<Layout>(OP_GETGLOBAL);
+    for (int pc = 0; pc < nCode; pc += max(usage[pc].length, 1))
+    {
+        Instruction&         i = function.instructions[pc];
+        const RegisterUsage& u = usage[pc];
+        ShiftRegister<Layout>(i, u.a, code[pc].a, base, shift, Layout::SetA);
+        ShiftRegister<Layout>(i, u.b, code[pc].b, base, shift, Layout::SetB);
+        ShiftRegister<Layout>(i, u.c, code[pc].c, base, shift, Layout::SetC);
+
+        if (code[pc].op == OP_CLOSURE)
+        {
+            for (int j = 1; j < u.length; j++)
+            {
+                if (code[pc + j].op == OP_MOVE) {
+                    ShiftRegister<Layout>(function.instructions[pc + j], OPERAND_REGISTER, code[pc + j].b, base, shift, Layout::SetB);
+                }
+            }
+        }
+
+        if (rewrite[pc] >= 0) {
+            i = Layout::CreateABC(MOVE, Layout::GetA(i), base + rewrite[pc], 0);
+        }
+    }
+
+    // Insert all loads at once, in the order of their positions
+    sort(loads.begin(), loads.end());
+    vector<Insertion> insertions;
+    for (size_t l = 0; l < loads.size(); l++)
+    {
+        Insertion insertion = {loads[l].pc, Layout::CreateABx(GETGLOBAL, base + loads[l].global, constants[loads[l].global])};
+        insertions.push_back(insertion);
+    }
+    InsertInstructions<Layout>(function, insertions);
+    function.maxStackSize = (unsigned char)(function.maxStackSize + shift);
+
+    // Declare the cache registers as locals right after the parameters
+    if (!function.locals.empty())
+    {
+        vector<Local> cacheLocals(shift);
+        for (map<string,int>::const_iterator p = globals.begin(); p != globals.end(); ++p)
+        {
+            Local& local  = cacheLocals[p->second];
+            local.name    = "(global " + p->first + ")";
+            local.startPC = 0;
+            local.endPC   = (int)function.instructions.size();
+        }
+        const size_t position = min<size_t>(base, function.locals.size());
+        function.locals.insert(function.locals.begin() + position, cacheLocals.begin(), cacheLocals.end());
+    }
+}
+
+void CacheGlobals(File& file, Version version)
+{
+    TraceSpan span("cache globals");
+    switch (version)
+    {
+        case LUA_50:
+        case LUA_EAW:
+            CacheFunctionGlobals<Lua50::Layout>(file.function);
+            break;
+
+        case LUA_51:
+        case LUA_UAW:
+            CacheFunctionGlobals<Lua51::Layout>(file.function);
+            break;
+
+        default:
+            break;
+    }
+}
+
+}
@@ -0,0 +1,30 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <string>
+#include "types.h"
+
+// 64-bit FNV-1a, used to identify functions and files by their contents
+class Hash
+{
+    uint64_t m_value;
+
+public:
+    void Add(const void* data, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            m_value = (m_value ^ bytes[i]) * 0x100000001B3ULL;
+        }
+    }
+
+    void Add(uint64_t value)           { value = htolell(value); Add(&value, sizeof value); }
+    void Add(const std::string& str)   { Add((uint64_t)str.length()); Add(str.c_str(), str.length()); }
+
+    uint64_t Value() const { return m_value; }
+
+    Hash() : m_value(0xCBF29CE484222325ULL) {}
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include "index.h"
+#include "formats.h"
+#include "opcodes.h"
+#include "corpus.h"
+#include "lua_io.h"
+#include "exceptions.h"
+#include "trace.h"
+using namespace std;
+
+namespace Lua {
+
+//
+// Index file
+//
+// After the header follow the number of files and of globals and a table of
+// each, sorted by name. An entry of a table holds the offset of its name and
+// of its records, so a lookup can binary-search the table with a few seeks
+// and then read just the records it needs. The records of a file are its
+// functions in preorder; those of a global are the offsets of the functions
+// that use it. All offsets count from the start of the header.
+//
+
+#pragma pack(1)
+struct IndexHeader
+{
+    char          signature[4];
+    unsigned char version;
+};
+#pragma pack()
+
+static const char          INDEX_SIGNATURE[4] = {'\033', 'L', 'i', 'x'};
+static const unsigned char INDEX_VERSION      = 2;
+
+// Size of a table entry and of the header and counts before the tables
+static const int TABLE_ENTRY_SIZE = 2 * sizeof(int);
+static const int TABLES_OFFSET    = sizeof(IndexHeader) + 2 * sizeof(int);
+
+// Smallest size of a function record and of a use
+static const int FUNCTION_RECORD_SIZE = 4 * sizeof(int);
+static const int USE_RECORD_SIZE      = sizeof(int) + 1;
+
+static const int USE_READ  = 1;
+static const int USE_WRITE = 2;
+
+//
+// Building
+//
+
+struct FunctionRecord
+{
+    string          path;
+    int             firstLine;
+    int             lastLine;
+    map<string,int> globals;    // name -> USE_ flags
+};
+
+static void GetLineRange(const Function& function, int& firstLine, int& lastLine)
+{
+    firstLine = function.lineDefined;
+    lastLine  = function.lastLineDefined;
+    if (lastLine < firstLine)
+    {
+        // Lua 5.0 does not store the last line, so take it from the line info
+        lastLine = firstLine;
+        for (size_t i = 0; i < function.lines.size(); i++) {
+            lastLine = max(lastLine, function.lines[i]);
+        }
+    }
+}
+
+template <typename Layout>
+static void IndexFunction(const Function& function, const string& path, vector<FunctionRecord>& records)
+{
+    records.push_back(FunctionRecord());
+    FunctionRecord& record = records.back();
+    record.path = path;
+    GetLineRange(function, record.firstLine, record.lastLine);
+
+    for (const InstructionView<Layout> i : CodeView<Layout>(function.instructions))
+    {
+        const OpCode op = i.Op();
+        if (op == OP_GETGLOBAL || op == OP_SETGLOBAL)
+        {
+            const size_t k = i.Bx();
+            if (k < function.constants.size() && function.constants[k].type == TSTRING) {
+                record.globals[function.constants[k].str] |= (op == OP_GETGLOBAL) ? USE_READ : USE_WRITE;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < function.functions.size(); i++)
+    {
+        IndexFunction<Layout>(function.functions[i], path + "." + to_string(i), records);
+    }
+}
+
+void BuildIndex(const string& root, ostream& output, vector<string>& errors)
+{
+    vector<string> files;
+    ListFiles(root, files);
+
+    // Load and scan the files in parallel, each into its own slot
+    vector<vector<FunctionRecord> > records(files.size());
+    vector<string>                  failures(files.size());
+    ParallelFor(files.size(), [&](size_t i)
+    {
+        try
+        {
+            ifstream input;
+            {
+                TraceSpan span("open", files[i].c_str());
+                input.open(GetFilePath(root, files[i]), ios_base::binary | ios_base::in);
+            }
+            if (!input.is_open()) {
+                throw FileNotFoundException();
+            }
+
+            File file;
+            switch (ReadAnyFile(input, file))
+            {
+                case LUA_50:
+                case LUA_EAW: IndexFunction<Lua50::Layout>(file.function, "main", records[i]); break;
+                case LUA_51:
+                case LUA_UAW: IndexFunction<Lua51::Layout>(file.function, "main", records[i]); break;
+                default:      failures[i] = "not a supported Lua file"; break;
+            }
+        }
+        catch (exception& e)
+        {
+            records[i].clear();
+            failures[i] = e.what();
+        }
+    });
+
+    // Merge the results
+    map<string, vector<pair<int,int> > > globals;
+    int nFunctions = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!failures[i].empty()) {
+            errors.push_back(files[i] + ": " + failures[i]);
+        }
+        for (size_t j = 0; j < records[i].size(); j++, nFunctions++)
+        {
+            const map<string,int>& uses = records[i][j].globals;
+            for (map<string,int>::const_iterator p = uses.begin(); p != uses.end(); ++p) {
+                globals[p->first].push_back(make_pair(nFunctions, p->second));
+            }
+        }
+    }
+
+    // The names and records follow the tables, so their offsets are known
+    // once they have been written to memory
+    const int dataOffset = TABLES_OFFSET + (int)(files.size() + globals.size()) * TABLE_ENTRY_SIZE;
+    ostringstream data(ios_base::out | ios_base::binary);
+    Writer        dataWriter(data);
+
+    vector<int> fileEntries;
+    vector<int> functionOffsets;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        fileEntries.push_back(dataOffset + (int)data.tellp());
+        dataWriter.WriteString(files[i]);
+        fileEntries.push_back(dataOffset + (int)data.tellp());
+        dataWriter.WriteInt((int)records[i].size());
+        for (size_t j = 0; j < records[i].size(); j++)
+        {
+            functionOffsets.push_back(dataOffset + (int)data.tellp());
+            dataWriter.WriteInt((int)i);
+            dataWriter.WriteString(records[i][j].path);
+            dataWriter.WriteInt(records[i][j].firstLine);
+            dataWriter.WriteInt(records[i][j].lastLine);
+        }
+    }
+
+    vector<int> globalEntries;
+    for (map<string, vector<pair<int,int> > >::const_iterator p = globals.begin(); p != globals.end(); ++p)
+    {
+        globalEntries.push_back(dataOffset + (int)data.tellp());
+        dataWriter.WriteString(p->first);
+        globalEntries.push_back(dataOffset + (int)data.tellp());
+        dataWriter.WriteInt((int)p->second.size());
+        for (size_t i = 0; i < p->second.size(); i++)
+        {
+            dataWriter.WriteInt (functionOffsets[p->second[i].first]);
+            dataWriter.WriteByte(p->second[i].second);
+        }
+    }
+
+    IndexHeader header;
+    memcpy(header.signature, INDEX_SIGNATURE, 4);
+    header.version = INDEX_VERSION;
+
+    Writer writer(output);
+    writer.Write(&header, sizeof header);
+    writer.WriteInt((int)files.size());
+    writer.WriteInt((int)globals.size());
+    for (size_t i = 0; i < fileEntries.size(); i++) {
+        writer.WriteInt(fileEntries[i]);
+    }
+    for (size_t i = 0; i < globalEntries.size(); i++) {
+        writer.WriteInt(globalEntries[i]);
+    }
+    const string result = data.str();
+    writer.Write(result.data(), result.size());
+}
+
+//
+// Lookups
+//
+
+Index::Index(istream& input)
+    : m_input(input)
+{
+    m_start = input.tellg();
+    if (m_start < 0) {
+        throw IOException("The index must be read from a file");
+    }
+
+    Reader reader(input);
+    IndexHeader header;
+    reader.Read(&header, sizeof header);
+    if (memcmp(header.signature, INDEX_SIGNATURE, 4) != 0 || header.version != INDEX_VERSION) {
+        throw BadFileException();
+    }
+    m_nFiles   = (int)reader.ReadCount(TABLE_ENTRY_SIZE);
+    m_nGlobals = (int)reader.ReadCount(TABLE_ENTRY_SIZE);
+}
+
+void Index::Seek(int offset) const
+{
+    m_input.clear();
+    m_input.seekg(m_start + (streamoff)offset);
+    if (offset < 0 || m_input.fail()) {
+        throw BadFileException();
+    }
+}
+
+string Index::ReadName(int offset) const
+{
+    Seek(offset);
+    Reader reader(m_input);
+    return reader.ReadString();
+}
+
+int Index::FindEntry(int table, int count, const string& name) const
+{
+    // Binary search, reading only the names it compares
+    int first = 0, last = count;
+    while (first < last)
+    {
+        const int middle = first + (last - first) / 2;
+        Seek(table + middle * TABLE_ENTRY_SIZE);
+        Reader reader(m_input);
+        const int nameOffset    = reader.ReadInt();
+        const int recordsOffset = reader.ReadInt();
+
+        const int order = ReadName(nameOffset).compare(name);
+        if (order == 0) {
+            return recordsOffset;
+        }
+        if (order < 0) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    return -1;
+}
+
+IndexedFunction Index::ReadFunction(Reader& reader, int& file) const
+{
+    IndexedFunction function;
+    file               = reader.ReadInt();
+    function.path      = reader.ReadString();
+    function.firstLine = reader.ReadInt();
+    function.lastLine  = reader.ReadInt();
+    if (file < 0 || file >= m_nFiles) {
+        throw BadFileException();
+    }
+    return function;
+}
+
+void Index::FindGlobal(const string& name, vector<GlobalUse>& uses) const
+{
+    const int records = FindEntry(TABLES_OFFSET + m_nFiles * TABLE_ENTRY_SIZE, m_nGlobals, name);
+    if (records < 0) {
+        return;
+    }
+
+    vector<pair<int, int> > functions;  // offset, USE_ flags
+    {
+        Seek(records);
+        Reader reader(m_input);
+        const size_t count = reader.ReadCount(USE_RECORD_SIZE);
+        for (size_t i = 0; i < count; i++)
+        {
+            const int offset = reader.ReadInt();
+            functions.push_back(make_pair(offset, reader.ReadByte()));
+        }
+    }
+
+    for (size_t i = 0; i < functions.size(); i++)
+    {
+        Seek(functions[i].first);
+        Reader reader(m_input);
+        int file;
+        GlobalUse use;
+        use.function = ReadFunction(reader, file);
+        use.reads    = (functions[i].second & USE_READ)  != 0;
+        use.writes   = (functions[i].second & USE_WRITE) != 0;
+
+        Seek(TABLES_OFFSET + file * TABLE_ENTRY_SIZE);
+        const int nameOffset = Reader(m_input).ReadInt();
+        use.function.file = ReadName(nameOffset);
+        uses.push_back(use);
+    }
+}
+
+bool Index::FindLine(const string& file, int line, IndexedFunction& function) const
+{
+    const int records = FindEntry(TABLES_OFFSET, m_nFiles, file);
+    if (records < 0) {
+        return false;
+    }
+
+    // The innermost function is the covering one that starts last. The main
+    // function (defined on line 0) covers every line.
+    Seek(records);
+    Reader reader(m_input);
+    const size_t count = reader.ReadCount(FUNCTION_RECORD_SIZE);
+    bool found = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        int fileIndex;
+        const IndexedFunction f = ReadFunction(reader, fileIndex);
+        if ((f.firstLine <= line && line <= f.lastLine) || f.firstLine == 0)
+        {
+            if (!found || f.firstLine > function.firstLine ||
+                (f.firstLine == function.firstLine && f.lastLine < function.lastLine)) {
+                function = f;
+                found    = true;
+            }
+        }
+    }
+    if (found) {
+        function.file = file;
+    }
+    return found;
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef INDEX_H
+#define INDEX_H
+// Corpus-wide index of global names and function line ranges
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace Lua
+{
+
+struct IndexedFunction
+{
+    std::string file;
+    std::string path;       // position in the function tree: main, main.0, ...
+    int         firstLine;
+    int         lastLine;
+};
+
+struct GlobalUse
+{
+    IndexedFunction function;
+    bool            reads;
+    bool            writes;
+};
+
+// Loads every file below root in parallel and writes the index of the
+// globals each function reads and writes through GETGLOBAL and SETGLOBAL,
+// and of the lines each function covers. Files that cannot be loaded are
+// skipped and described in errors.
+void BuildIndex(const std::string& root, std::ostream& output, std::vector<std::string>& errors);
+
+class Reader;
+
+// Looks up single names in an index without reading all of it. The stream
+// must be able to seek and stay open while the index is used.
+class Index
+{
+    std::istream&  m_input;
+    std::streamoff m_start;     // position of the index in the stream
+    int            m_nFiles;
+    int            m_nGlobals;
+
+    void            Seek(int offset) const;
+    std::string     ReadName(int offset) const;
+    IndexedFunction ReadFunction(Reader& reader, int& file) const;
+
+    // Returns the offset of the records of the name in a table, or -1
+    int FindEntry(int table, int count, const std::string& name) const;
+
+public:
+    // Returns every function that reads or writes the global
+    void FindGlobal(const std::string& name, std::vector<GlobalUse>& uses) const;
+
+    // Returns the innermost function of the file that covers the line
+    bool FindLine(const std::string& file, int line, IndexedFunction& function) const;
+
+    // Reads just the header; throws a BadFileException if it is not valid
+    Index(std::istream& input);
+};
+
+}
+#endif
@@ -0,0 +1,72 @@
+#include "opcodes.h"
+#include "exceptions.h"
+using namespace std;
+
+namespace Lua {
+
+//
+// Linking
+//
+// The main functions of the files become the nested functions of a loader
+// that creates and calls each of them in turn:
+//
+//   CLOSURE 0 i
+//   CALL    0 1 1
+//   ...
+//   RETURN  0 1
+//
+
+template <typename Layout>
+static void LinkFunctions(const vector<File>& files, Function& loader)
+{
+    constexpr int CLOSURE = GetOpcodeNumber<Layout>(OP_CLOSURE);
+    constexpr int CALL    = GetOpcodeNumber<Layout>(OP_CALL);
+    constexpr int RETURN  = GetOpcodeNumber<Layout>(OP_RETURN);
+
+    loader.name            = "=linked";
+    loader.lineDefined     = 0;
+    loader.lastLineDefined = 0;
+    loader.nUpvalues       = 0;
+    loader.nParameters     = 0;
+    loader.isVararg        = files[0].function.isVararg;
+    loader.maxStackSize    = 2;
+
+    loader.functions.resize(files.size());
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (files[i].function.nUpvalues != 0) {
+            throw BadCodeException("Cannot link a function with upvalues");
+        }
+        loader.functions[i] = files[i].function;
+        loader.instructions.push_back(Layout::CreateABx(CLOSURE, 0, (int)i));
+        loader.instructions.push_back(Layout::CreateABC(CALL, 0, 1, 1));
+    }
+    loader.instructions.push_back(Layout::CreateABC(RETURN, 0, 1, 0));
+    loader.lines.assign(loader.instructions.size(), 0);
+}
+
+void LinkFiles(const vector<File>& files, Version version, File& output)
+{
+    if (files.empty()) {
+        throw BadCodeException("Nothing to link");
+    }
+
+    output.function = Function();
+    switch (version)
+    {
+        case LUA_50:
+        case LUA_EAW:
+            LinkFunctions<Lua50::Layout>(files, output.function);
+            break;
+
+        case LUA_51:
+        case LUA_UAW:
+            LinkFunctions<Lua51::Layout>(files, output.function);
+            break;
+
+        default:
+            throw BadCodeException("Cannot link files of an unknown version");
+    }
+}
+
+}
@@ -64,16 +64,25 @@ struct File
 	Function function;
 };
 
+// The codecs are instantiated for every format in formats.h that uses their layout
 namespace Lua50
 {
-    void ReadFile(std::istream& input, File& file, bool isLup);
-    void WriteFile(std::ostream& output, const File& file, bool isLup);
+    struct Codec
+    {
+        template <typename Format> static void ReadFile(std::istream& input, File& file);
+        template <typename Format> static void WriteFile(std::ostream& output, const File& file);
+        template <typename Format> static void CheckHeader(std::istream& input);
+    };
 }
 
 namespace Lua51
 {
-    void ReadFile(std::istream& input, File& file, bool isLup);
-    void WriteFile(std::ostream& output, const File& file, bool isLup);
+    struct Codec
+    {
+        template <typename Format> static void ReadFile(std::istream& input, File& file);
+        template <typename Format> static void WriteFile(std::ostream& output, const File& file);
+        template <typename Format> static void CheckHeader(std::istream& input);
+    };
 }
 
 enum Version
@@ -85,7 +94,39 @@ enum Version
     LUA_UAW,
 };
 
-Version DetectFileVersion(std::istream& input);
+// Detects the format from the first bytes of a file. DETECT_SIZE bytes are
+// enough; fewer are fine for files that are shorter.
+static const size_t DETECT_SIZE = 6;
+Version DetectFileVersion(const void* header, size_t size);
+
+// Checks the code of every function against the limits the game's VM trusts
+// without checking. Throws a BadCodeException on the first violation.
+void VerifyFile(const File& file, Version version);
+
+// Function-level patches between two versions of a chunk. The patch records
+// the version of the new chunk so it can be written in its original format.
+void    WritePatch(std::ostream& output, const File& oldFile, const File& newFile, Version version);
+Version ApplyPatch(std::istream& input, const File& oldFile, File& newFile);
+
+// Renumbers the registers of every function that are only used on their own
+// to the lowest ones free at that point and lowers maxStackSize to the highest
+// register still used. Expects verified code.
+void MinimizeStack(File& file, Version version);
+
+// Loads the globals that loops read but do not write into registers before
+// the loops and reads those registers instead. Only correct if the functions
+// called in the loops do not assign these globals. Expects verified code.
+void CacheGlobals(File& file, Version version);
+
+// Moves the constants that instructions could name directly, instead of
+// loading them into a register first, to the part of every function's
+// constant table that they can name, and removes those loads. Expects
+// verified code.
+void ReorderConstants(File& file, Version version);
+
+// Bundles the files, all of the given version, into one whose main function
+// runs their main functions in order
+void LinkFiles(const std::vector<File>& files, Version version, File& output);
 
 }
 #endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "lua_io.h"
+#include "formats.h"
 #include "exceptions.h"
+#include "trace.h"
 using namespace std;
 
 namespace Lua {
@@ -25,20 +27,17 @@ struct Header
 };
 #pragma pack()
 
-static Reader ReadHeader(istream& input, bool isLup)
+// Returns the width of the numbers in the file
+template <typename Format>
+static size_t ReadHeader(Reader& reader)
 {
     Header header;
-	input.read( (char*)&header, sizeof header );
-    if (input.fail()) {
-        throw IOException("Unable to read file");
-    }
+	reader.Read(&header, sizeof header);
 
-    unsigned char format = (isLup ? 'p' : 0);
-	
 	// Validate header
-	if ((strncmp(header.signature, "\033Lua", 4) != 0) ||
-		(header.version         != 0x51) ||
-        (header.format          != format) ||
+	if ((strncmp(header.signature, Format::Signature(), 4) != 0) ||
+		(header.version         != Format::VersionByte) ||
+        (header.format          != Format::FormatByte) ||
 		(header.endianness      != 1) ||
 		(header.sizeInt			!= 4) ||
 		(header.sizeSize_t		!= 4) ||
@@ -48,25 +47,27 @@ static Reader ReadHeader(istream& input, bool isLup)
 	{
 		throw BadFileException();
 	}
-
-    return Reader(input, header.sizeNumber);
+    return header.sizeNumber;
 }
 
 static void ReadLines(Reader& reader, vector<Line>& lines)
 {
-	lines.resize( reader.ReadInt() );
-	for (size_t i = 0; i < lines.size(); i++)
+	const size_t count = reader.ReadCount(sizeof(int));
+	reader.Reserve(lines, count);
+	for (size_t i = 0; i < count; i++)
 	{
-		lines[i] = reader.ReadInt();
+		lines.push_back(reader.ReadInt());
 	}
 }
 
 static void ReadLocals(Reader& reader, vector<Local>& locals)
 {
-	locals.resize( reader.ReadInt() );
-	for (size_t i = 0; i < locals.size(); i++)
+	const size_t count = reader.ReadCount(3 * sizeof(int));
+	reader.Reserve(locals, count);
+	for (size_t i = 0; i < count; i++)
 	{
-        Local& local = locals[i];
+        locals.push_back(Local());
+        Local& local = locals.back();
 		local.name    = reader.ReadString();
 		local.startPC = reader.ReadInt();
 		local.endPC   = reader.ReadInt();
@@ -75,23 +76,27 @@ static void ReadLocals(Reader& reader, vector<Local>& locals)
 
 static void ReadUpvalues(Reader& reader, vector<UpValue>& upvalues)
 {
-	upvalues.resize( reader.ReadInt() );
-	for (size_t i = 0; i < upvalues.size(); i++)
+	const size_t count = reader.ReadCount(sizeof(int));
+	reader.Reserve(upvalues, count);
+	for (size_t i = 0; i < count; i++)
 	{
-		upvalues[i] = reader.ReadString();
+		upvalues.push_back(reader.ReadString());
 	}
 }
 
+template <typename Number>
 static void ReadConstants(Reader& reader, vector<Constant>& constants)
 {
-	constants.resize( reader.ReadInt() );
-	for (size_t i = 0; i < constants.size(); i++)
+	const size_t count = reader.ReadCount(1);
+	reader.Reserve(constants, count);
+	for (size_t i = 0; i < count; i++)
 	{
-		Constant& constant = constants[i];
+		constants.push_back(Constant());
+		Constant& constant = constants.back();
 		constant.type = (Type)reader.ReadByte();
 		switch (constant.type)
 		{
-			case TNUMBER:  constant.number  = reader.ReadNumber(); break;
+			case TNUMBER:  constant.number  = reader.ReadNumber<Number>(); break;
 			case TSTRING:  constant.str     = reader.ReadString(); break;
             case TBOOLEAN: constant.boolean = reader.ReadByte() != 0; break;
 			case TNIL:     break;
@@ -101,32 +106,40 @@ static void ReadConstants(Reader& reader, vector<Constant>& constants)
 	}
 }
 
-static void ReadFunction(Reader& reader, Function& function, bool isLup);
+template <typename Format, typename Number>
+static void ReadFunction(Reader& reader, Function& function, int depth);
 
-static void ReadFunctions(Reader& reader, vector<Function>& functions, bool isLup)
+template <typename Format, typename Number>
+static void ReadFunctions(Reader& reader, vector<Function>& functions, int depth)
 {
-	functions.resize( reader.ReadInt() );
-	for (size_t i = 0; i < functions.size(); i++)
+	const size_t count = reader.ReadCount(sizeof(int));
+	reader.Reserve(functions, count);
+	for (size_t i = 0; i < count; i++)
 	{
-		ReadFunction(reader, functions[i], isLup);
+		// Functions nested directly in the main one are traced one by one
+		TraceSpan span((depth == 1) ? "read function" : NULL);
+		functions.push_back(Function());
+		ReadFunction<Format, Number>(reader, functions.back(), depth);
 	}
 }
 
 static void ReadInstructions(Reader& reader, vector<Instruction>& instructions)
 {
-    instructions.resize( reader.ReadInt() );
-	for (size_t i = 0; i < instructions.size(); i++)
+    const size_t count = reader.ReadCount(sizeof(int));
+    reader.Reserve(instructions, count);
+	for (size_t i = 0; i < count; i++)
 	{
-		instructions[i] = reader.ReadInt();
+		instructions.push_back(reader.ReadInt());
 	}
 }
 
-static void ReadFunction(Reader& reader, Function& function, bool isLup)
+template <typename Format, typename Number>
+static void ReadFunction(Reader& reader, Function& function, int depth)
 {
 	function.name            = reader.ReadString();
 	function.lineDefined     = reader.ReadInt();
     function.lastLineDefined = reader.ReadInt();
-	if (isLup)
+	if (Format::HasPetroInt)
 	{
         // Read the special Petroglyph integer
 		reader.ReadInt();
@@ -135,41 +148,60 @@ static void ReadFunction(Reader& reader, Function& function, bool isLup)
 	function.nParameters  = reader.ReadByte();
 	function.isVararg     = reader.ReadByte();
 	function.maxStackSize = reader.ReadByte();
-	ReadInstructions(reader, function.instructions);
-	ReadConstants   (reader, function.constants);
-	ReadFunctions   (reader, function.functions, isLup);
-    ReadLines       (reader, function.lines);
-    ReadLocals      (reader, function.locals);
-	ReadUpvalues    (reader, function.upvalues);
+	ReadInstructions             (reader, function.instructions);
+	ReadConstants<Number>        (reader, function.constants);
+	ReadFunctions<Format, Number>(reader, function.functions, depth + 1);
+    ReadLines                    (reader, function.lines);
+    ReadLocals                   (reader, function.locals);
+	ReadUpvalues                 (reader, function.upvalues);
 }
 
-void ReadFile(istream& input, File& file, bool isLup)
+template <typename Format>
+void Codec::ReadFile(istream& input, File& file)
 {
-    Reader reader = ReadHeader(input, isLup);
-	ReadFunction(reader, file.function, isLup);
+    Reader reader(input);
+
+    // Lua 5.1 files may be compiled with either number width, so this is
+    // the one choice that is made per file rather than per format
+    size_t sizeNumber;
+    {
+        TraceSpan span("read header");
+        sizeNumber = ReadHeader<Format>(reader);
+    }
+    if (sizeNumber == sizeof(float)) {
+        ReadFunction<Format, float>(reader, file.function, 0);
+    } else {
+        ReadFunction<Format, double>(reader, file.function, 0);
+    }
+}
+
+template <typename Format>
+void Codec::CheckHeader(istream& input)
+{
+    Reader reader(input);
+    ReadHeader<Format>(reader);
 }
 
 //
 // Writing
 //
 
-static Writer WriteHeader(ostream& output, bool isLup)
+template <typename Format>
+static void WriteHeader(Writer& writer)
 {
 	// Fill header
     Header header;
-	memcpy(header.signature, "\033Lua", 4);
-	header.version         = 0x51;
-    header.format          = (isLup ? 'p' : 0);
+	memcpy(header.signature, Format::Signature(), 4);
+	header.version         = Format::VersionByte;
+    header.format          = Format::FormatByte;
 	header.endianness      = 1;
 	header.sizeInt		   = 4;
 	header.sizeSize_t	   = 4;
 	header.sizeInstruction = 4;
-	header.sizeNumber      = 4;
+	header.sizeNumber      = sizeof(typename Format::Number);
     header.integral        = 0;
 
-    Writer writer(output, header.sizeNumber);
 	writer.Write( (char*)&header, sizeof header );
-    return writer;
 }
 
 static void WriteLines(Writer& writer, const vector<Line>& lines)
@@ -201,6 +233,7 @@ static void WriteUpvalues(Writer& writer, const vector<UpValue>& upvalues)
 	}
 }
 
+template <typename Format>
 static void WriteConstants(Writer& writer, const vector<Constant>& constants )
 {
 	writer.WriteInt((unsigned int)constants.size());
@@ -209,7 +242,7 @@ static void WriteConstants(Writer& writer, const vector<Constant>& constants )
 		writer.WriteByte(constants[i].type);
 		switch (constants[i].type)
 		{
-			case TNUMBER:  writer.WriteNumber(constants[i].number); break;
+			case TNUMBER:  writer.WriteNumber<typename Format::Number>(constants[i].number); break;
 			case TSTRING:  writer.WriteString(constants[i].str); break;
             case TBOOLEAN: writer.WriteByte  (constants[i].boolean ? 1 : 0); break;
 			case TNIL:     break;
@@ -217,14 +250,17 @@ static void WriteConstants(Writer& writer, const vector<Constant>& constants )
 	}
 }
 
-static void WriteFunction(Writer& writer, const Function& function, int* petroValue);
+template <typename Format>
+static void WriteFunction(Writer& writer, const Function& function, int& petroValue, int depth);
 
-static void WriteFunctions(Writer writer, const vector<Function>& functions, int* petroValue)
+template <typename Format>
+static void WriteFunctions(Writer& writer, const vector<Function>& functions, int& petroValue, int depth)
 {
 	writer.WriteInt((unsigned int)functions.size());
 	for (size_t i = 0; i < functions.size(); i++)
 	{
-		WriteFunction(writer, functions[i], petroValue);
+		TraceSpan span((depth == 1) ? "write function" : NULL);
+		WriteFunction<Format>(writer, functions[i], petroValue, depth);
 	}
 }
 
@@ -237,33 +273,50 @@ static void WriteInstructions(Writer& writer, const vector<Instruction>& instruc
 	}
 }
 
-static void WriteFunction( Writer& writer, const Function& function, int* petroValue)
+template <typename Format>
+static void WriteFunction(Writer& writer, const Function& function, int& petroValue, int depth)
 {
 	writer.WriteString(function.name, true);
 	writer.WriteInt(function.lineDefined);
     writer.WriteInt(function.lastLineDefined);
-	if (petroValue != NULL)
+	if (Format::HasPetroInt)
 	{
-		writer.WriteInt((*petroValue)++);
+		writer.WriteInt(petroValue++);
 	}
 	writer.WriteByte(function.nUpvalues);
 	writer.WriteByte(function.nParameters);
 	writer.WriteByte(function.isVararg);
 	writer.WriteByte(function.maxStackSize);
-	WriteInstructions(writer, function.instructions);
-	WriteConstants   (writer, function.constants);
-	WriteFunctions   (writer, function.functions, petroValue);
-    WriteLines       (writer, function.lines);
-    WriteLocals      (writer, function.locals);
-	WriteUpvalues    (writer, function.upvalues);
+	WriteInstructions     (writer, function.instructions);
+	WriteConstants<Format>(writer, function.constants);
+	WriteFunctions<Format>(writer, function.functions, petroValue, depth + 1);
+    WriteLines            (writer, function.lines);
+    WriteLocals           (writer, function.locals);
+	WriteUpvalues         (writer, function.upvalues);
 }
 
-void WriteFile(ostream& output, const File& file, bool isLup)
+template <typename Format>
+void Codec::WriteFile(ostream& output, const File& file)
 {
     int petroValue = 1;
-    Writer writer = WriteHeader(output, isLup);
-    WriteFunction(writer, file.function, isLup ? &petroValue : NULL);
+    Writer writer(output);
+    {
+        TraceSpan span("write header");
+        WriteHeader<Format>(writer);
+    }
+    WriteFunction<Format>(writer, file.function, petroValue, 0);
 }
 
+//
+// Formats with the Lua 5.1 layout
+//
+
+template void Codec::ReadFile <FormatLua51> (istream& input, File& file);
+template void Codec::WriteFile<FormatLua51> (ostream& output, const File& file);
+template void Codec::CheckHeader<FormatLua51>(istream& input);
+template void Codec::ReadFile <FormatLupUaW>(istream& input, File& file);
+template void Codec::WriteFile<FormatLupUaW>(ostream& output, const File& file);
+template void Codec::CheckHeader<FormatLupUaW>(istream& input);
+
 }
 }
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <cstdint>
+#include <cstring>
 #include "lua_io.h"
 #include "exceptions.h"
 using namespace std;
@@ -5,22 +7,48 @@ using namespace std;
 namespace Lua
 {
 
-Reader::Reader(std::istream& input, size_t sizeNumber)
-    : m_input(input), m_sizeNumber(sizeNumber)
+Reader::Reader(std::istream& input)
+    : m_input(input), m_remaining(SIZE_MAX)
 {
+    // Bound the counts by the size of the rest of the stream if it is known
+    streambuf* buffer = input.rdbuf();
+    const streampos position = buffer->pubseekoff(0, ios_base::cur, ios_base::in);
+    if (position != streampos(-1))
+    {
+        const streampos end = buffer->pubseekoff(0, ios_base::end, ios_base::in);
+        buffer->pubseekpos(position, ios_base::in);
+        if (end != streampos(-1) && end >= position) {
+            m_remaining = (size_t)(end - position);
+        }
+    }
 }
 
-Writer::Writer(std::ostream& output, size_t sizeNumber)
-    : m_output(output), m_sizeNumber(sizeNumber)
+Writer::Writer(std::ostream& output)
+    : m_output(output)
 {
 }
 
 void Reader::Read(void* dest, size_t size)
 {
+    if (size > m_remaining) {
+        throw IOException("Unable to read file");
+    }
     m_input.read((char*)dest, (streamsize)size);
     if (m_input.fail()) {
         throw IOException("Unable to read file");
     }
+    if (m_remaining != SIZE_MAX) {
+        m_remaining -= size;
+    }
+}
+
+size_t Reader::ReadCount(size_t elementSize)
+{
+    const int count = ReadInt();
+    if (count < 0 || (size_t)count > m_remaining / elementSize) {
+        throw BadFileException();
+    }
+    return (size_t)count;
 }
 
 void Writer::Write(const void* src, size_t size)
@@ -33,7 +61,7 @@ void Writer::Write(const void* src, size_t size)
 
 string Reader::ReadString()
 {
-	int size = ReadInt();
+	int size = (int)ReadCount(1);
     
     string str;
     if (size > 0)
@@ -68,10 +96,7 @@ void Writer::WriteString(const string& str, bool null_if_empty)
 int Reader::ReadInt()
 {
 	int32_t value;
-	m_input.read( (char*)&value, sizeof value );
-    if (m_input.fail()) {
-        throw IOException("Unable to read file");
-    }
+	Read(&value, sizeof value);
 	return letohl(value);
 }
 
@@ -87,10 +112,7 @@ void Writer::WriteInt(int val)
 int Reader::ReadByte()
 {
 	uint8_t value;
-	m_input.read( (char*)&value, sizeof value );
-    if (m_input.fail()) {
-        throw IOException("Unable to read file");
-    }
+	Read(&value, sizeof value);
 	return value;
 }
 
@@ -103,62 +125,97 @@ void Writer::WriteByte(int val)
     }
 }
 
-double Reader::ReadNumber()
+Version DetectFileVersion(const void* data, size_t size)
 {
-    if (m_sizeNumber == 4)
-    {
-	    float value;
-        Read(&value, sizeof value);
-        return value;
+    const char* header = (const char*)data;
+    if (size < 5) {
+        return LUA_UNKNOWN;
     }
 
-    double value;
-    Read(&value, sizeof value);
-	return value;
+    if (strncmp(header, "\033Lua", 4) == 0) {
+        if (header[4] == 0x50) {
+            return LUA_50;
+        } else if (header[4] == 0x51 && size >= 6) {
+            if (header[5] == 0) {
+                return LUA_51;
+            } else if (header[5] == 'p') {
+                return LUA_UAW;
+            }
+        }
+    } else if (strncmp(header, "\033Lup", 4) == 0 && header[4] == 0x51) {
+        return LUA_EAW;
+    }
+
+    return LUA_UNKNOWN;
 }
 
-void Writer::WriteNumber(double value)
+//
+// MemoryStreamBuf
+//
+
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekoff(off_type offset, ios_base::seekdir dir, ios_base::openmode which)
 {
-    if (m_sizeNumber == 4) {
-	    float v = (float)value;
-        Write(&v, sizeof v);
-    } else {
-	    Write(&value, sizeof value);
+    const off_type size = egptr() - eback();
+    off_type position = offset;
+    if (dir == ios_base::cur) {
+        position += gptr() - eback();
+    } else if (dir == ios_base::end) {
+        position += size;
     }
+
+    if ((which & ios_base::in) == 0 || position < 0 || position > size) {
+        return pos_type(off_type(-1));
+    }
+    setg(eback(), eback() + position, egptr());
+    return pos_type(position);
 }
 
-static Version DetectFileVersion(Reader& reader)
+MemoryStreamBuf::pos_type MemoryStreamBuf::seekpos(pos_type position, ios_base::openmode which)
 {
-    char signature[4];
-    reader.Read(signature, 4);
-    int version = reader.ReadByte();
+    return seekoff(off_type(position), ios_base::beg, which);
+}
 
-    if (strncmp(signature, "\033Lua", 4) == 0) {
-        if (version == 0x50) {
-            return LUA_50;
-        } else if (version == 0x51) {
-            int format = reader.ReadByte();
-            if (format == 0) {
-                return LUA_51;
-            } else if (format == 'p') {
-                return LUA_UAW;
-            }
-        }
-    } else if (strncmp(signature, "\033Lup", 4) == 0 && version == 0x51) {
-        return LUA_EAW;
+//
+// PeekedStreamBuf
+//
+
+PeekedStreamBuf::PeekedStreamBuf(const void* peeked, size_t size, streambuf* source)
+    : m_source(source)
+{
+    memcpy(m_buffer, peeked, size);
+    setg(m_buffer, m_buffer, m_buffer + size);
+}
+
+PeekedStreamBuf::int_type PeekedStreamBuf::underflow()
+{
+    const streamsize size = m_source->sgetn(m_buffer, sizeof m_buffer);
+    if (size <= 0) {
+        return traits_type::eof();
     }
+    setg(m_buffer, m_buffer, m_buffer + size);
+    return traits_type::to_int_type(*gptr());
+}
 
-    return LUA_UNKNOWN;
+PeekedStreamBuf::pos_type PeekedStreamBuf::seekoff(off_type offset, ios_base::seekdir dir, ios_base::openmode which)
+{
+    // The source is ahead of us by the bytes that are buffered but unread
+    if (dir == ios_base::cur) {
+        offset -= egptr() - gptr();
+    }
+    const pos_type position = m_source->pubseekoff(offset, dir, which);
+    if (position != pos_type(off_type(-1))) {
+        setg(m_buffer, m_buffer, m_buffer);
+    }
+    return position;
 }
 
-Version DetectFileVersion(istream& input)
+PeekedStreamBuf::pos_type PeekedStreamBuf::seekpos(pos_type position, ios_base::openmode which)
 {
-    Reader reader(input, 4);
-    Version version = DetectFileVersion(reader);
-    
-    // Reset stream
-    input.seekg(0);
-    return version;
+    position = m_source->pubseekpos(position, which);
+    if (position != pos_type(off_type(-1))) {
+        setg(m_buffer, m_buffer, m_buffer);
+    }
+    return position;
 }
 
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef LUA_IO_H
 #define LUA_IO_H
 
+#include <algorithm>
 #include "lua.h"
 
 namespace Lua
@@ -9,31 +10,98 @@ namespace Lua
 class Reader
 {
     std::istream& m_input;
-    size_t        m_sizeNumber;
+    size_t        m_remaining;  // bytes left in a stream that can seek
 
 public:
     void        Read(void* dest, size_t size);
     int         ReadByte();
     int         ReadInt();
-    double      ReadNumber();
     std::string ReadString();
 
-    Reader(std::istream& input, size_t sizeNumber);
+    // Reads the number of elements of an array whose elements take at least
+    // elementSize bytes. Throws a BadFileException if that many cannot fit in
+    // the rest of the stream, so corrupt counts are not allocated.
+    size_t      ReadCount(size_t elementSize);
+
+    // Makes room for count elements that are about to be read, but for no
+    // more than the rest of the stream takes. An element can need many times
+    // the bytes it is stored in, so the vector grows beyond that only as its
+    // elements are actually read.
+    template <typename T>
+    void Reserve(std::vector<T>& elements, size_t count) const
+    {
+        elements.clear();
+        elements.reserve(std::min(count, m_remaining / sizeof(T)));
+    }
+
+    template <typename Number>
+    double ReadNumber()
+    {
+        Number value;
+        Read(&value, sizeof value);
+        return value;
+    }
+
+    Reader(std::istream& input);
 };
 
 class Writer
 {
     std::ostream& m_output;
-    size_t        m_sizeNumber;
 
 public:
     void Write(const void* src, size_t size);
     void WriteByte(int val);
     void WriteInt(int val);
-    void WriteNumber(double value);
     void WriteString(const std::string& str, bool null_if_empty = false);
 
-    Writer(std::ostream& output, size_t sizeNumber);
+    template <typename Number>
+    void WriteNumber(double value)
+    {
+        Number v = (Number)value;
+        Write(&v, sizeof v);
+    }
+
+    Writer(std::ostream& output);
+};
+
+// Stream buffer that reads directly from memory, without a copy
+class MemoryStreamBuf : public std::streambuf
+{
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode which);
+    pos_type seekpos(pos_type position, std::ios_base::openmode which);
+
+public:
+    MemoryStreamBuf(const void* data, size_t size)
+    {
+        char* begin = const_cast<char*>((const char*)data);
+        setg(begin, begin, begin + size);
+    }
+
+    MemoryStreamBuf(const std::string& data)
+    {
+        char* begin = const_cast<char*>(data.data());
+        setg(begin, begin, begin + data.size());
+    }
+};
+
+// Stream buffer that first returns bytes already read from another stream
+// buffer and then continues with it. This lets a stream that cannot seek,
+// like a pipe, be peeked at. Seeks go to the other stream buffer, so a
+// stream that can seek still can.
+class PeekedStreamBuf : public std::streambuf
+{
+    std::streambuf* m_source;
+    char            m_buffer[4096];
+
+protected:
+    int_type underflow();
+    pos_type seekoff(off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode which);
+    pos_type seekpos(pos_type position, std::ios_base::openmode which);
+
+public:
+    PeekedStreamBuf(const void* peeked, size_t size, std::streambuf* source);
 };
 
 }
@@ -1,119 +1,639 @@
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
 
-#include "lua.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "formats.h"
+#include "index.h"
+#include "bench.h"
+#include "scan.h"
+#include "batch.h"
+#include "carve.h"
+#include "sizes.h"
+#include "trace.h"
 using namespace std;
+using Lua::LuaFormat;
+using Lua::LuaFormats;
 
-class LuaFormat
+struct Options
 {
-public:
-    virtual void Load(istream& input, Lua::File& file) const = 0;
-    virtual void Save(ostream& output, const Lua::File& file) const = 0;
+    bool        verify;
+    bool        minimizeStack;
+    bool        cacheGlobals;
+    bool        reorderConstants;
+    bool        convert;
+    const char* trace;
+    double      threshold;
+    int         shard;
+    int         nShards;
+
+    bool Optimizes() const { return minimizeStack || cacheGlobals || reorderConstants; }
+
+    Options() : verify(true), minimizeStack(false), cacheGlobals(false), reorderConstants(false), convert(false), trace(NULL), threshold(10), shard(0), nShards(1) {}
 };
 
-class SpecificLuaFormat : public LuaFormat
+static void PrintUsage()
 {
-    bool m_isLup;
-    bool m_isNew;
+    cerr << "Lup/Lua converter 1.1, by Mike Lankamp." << endl
+         << "Syntax: luacvt [options] <src-file> <dest-file>" << endl
+         << "        luacvt diff <old-file> <new-file> <patch-file>" << endl
+         << "        luacvt patch <old-file> <patch-file> <dest-file>" << endl
+         << "        luacvt index <src-dir> <index-file>" << endl
+         << "        luacvt find-global <index-file> <name>" << endl
+         << "        luacvt find-line <index-file> <file> <line>" << endl
+         << "        luacvt link <dest-file> <src-file>..." << endl
+         << "        luacvt bench <src-dir> <result-file> [<baseline-file>]" << endl
+         << "        luacvt scan <src-dir> <list-file>" << endl
+         << "        luacvt batch <src-dir> <dest-dir> <manifest-file>" << endl
+         << "        luacvt merge-manifests <dest-file> <manifest-file>..." << endl
+         << "        luacvt carve <src-file> <dest-dir>" << endl
+         << "        luacvt analyze <src-dir> <report-file>" << endl
+         << endl
+         << "The program will read a Lua or Lup file and convert it to a Lup or Lua file." << endl
+         << "The format of the source file is automatically detected and the appropriate" << endl
+         << "destination format selected. EaW/FoC Luas will be converted to Lua 5.0 files" << endl
+         << "and vica versa. UaW Luas will be converted to Lua 5.1 files and vica versa." << endl
+         << "A file name of - reads from standard input or writes to standard output." << endl
+         << endl
+         << "diff writes a patch that rebuilds the new file from the old one, reusing every" << endl
+         << "function that did not change. patch applies it and writes the new file in its" << endl
+         << "original format." << endl
+         << endl
+         << "index records, for every file below a directory, which functions read (r) or" << endl
+         << "write (w) which globals and which lines each function covers. find-global and" << endl
+         << "find-line look these up." << endl
+         << endl
+         << "link bundles files of the same format into one file that runs them in order," << endl
+         << "converted like a single file would be." << endl
+         << endl
+         << "bench converts every file below a directory in memory several times and" << endl
+         << "writes the latency percentiles, throughput and allocations per format pair" << endl
+         << "as JSON. Given an earlier result as baseline, it reports and fails on every" << endl
+         << "metric that got worse by more than the threshold. Allocations are only" << endl
+         << "counted by builds with COUNT_ALLOCATIONS defined. The peak memory is that of" << endl
+         << "the whole process, which includes the corpus it keeps in memory." << endl
+         << endl
+         << "scan reads only the header of every file below a directory and lists the" << endl
+         << "format, header status and size of each, tab-separated. A summary of the" << endl
+         << "counts is printed when it is done." << endl
+         << endl
+         << "batch converts every file below a directory into the same path below the" << endl
+         << "destination directory and writes a manifest with the hash and size of every" << endl
+         << "input and output file and the time its conversion took. With --shard it only" << endl
+         << "converts its share of the files, so several machines can split a corpus." << endl
+         << "merge-manifests combines the manifests of the shards into one." << endl
+         << endl
+         << "carve finds the compiled chunks embedded anywhere in a file, such as a save" << endl
+         << "game or memory dump, and extracts each into the destination directory, named" << endl
+         << "after its offset. With --convert they are converted instead." << endl
+         << endl
+         << "analyze reports how many bytes every file below a directory, and every" << endl
+         << "function in them, spends on code, constants by type, line info, locals and" << endl
+         << "upvalue names, and estimates the memory the game needs to load them. The" << endl
+         << "corpus totals come first, then the files and functions, largest first." << endl
+         << endl
+         << "Options:" << endl
+         << "  --no-verify            do not check the bytecode before writing the destination" << endl
+         << "                         file" << endl
+         << "  --convert              have carve convert the chunks it finds" << endl
+         << "  --cache-globals        load the globals a loop reads into registers before the" << endl
+         << "                         loop; only safe if nothing called in a loop assigns" << endl
+         << "                         them" << endl
+         << "  --minimize-stack       renumber registers to lower the stack size of every" << endl
+         << "                         function" << endl
+         << "  --reorder-constants    move the constants that instructions can name directly to" << endl
+         << "                         the front of the constant table and drop the loads" << endl
+         << "                         they no longer need" << endl
+         << "  --trace <file>         write the time spent in each step as Chrome trace-event" << endl
+         << "                         JSON" << endl
+         << "  --shard <i>/<n>        have batch convert only the i-th of n shards of about" << endl
+         << "                         equal size, counting from 1" << endl
+         << "  --threshold <percent>  how much worse than the baseline a bench metric may get" << endl
+         << "                         (default 10)" << endl;
+}
 
-    void Load(istream& input, Lua::File& file) const
+// Opens a file for reading, or standard input for "-". Returns NULL and
+// reports the problem if it cannot be opened.
+static istream* OpenInput(const char* path, ifstream& file)
+{
+    TraceSpan span("open", path);
+    if (strcmp(path, "-") == 0)
     {
-        if (m_isNew) {
-            Lua::Lua51::ReadFile(input, file, m_isLup);
-        } else {
-            Lua::Lua50::ReadFile(input, file, m_isLup);
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        return &cin;
+    }
+
+    file.open(path, ios_base::binary | ios_base::in);
+    if (!file.is_open())
+    {
+        cerr << "Unable to open input file \"" << path << "\"" << endl;
+        return NULL;
+    }
+    return &file;
+}
+
+// Opens a file for writing, or standard output for "-"
+static ostream* OpenOutput(const char* path, ofstream& file)
+{
+    TraceSpan span("open", path);
+    if (strcmp(path, "-") == 0)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        return &cout;
+    }
+
+    file.open(path, ios_base::binary | ios_base::out);
+    if (!file.is_open())
+    {
+        cerr << "Unable to open output file \"" << path << "\"" << endl;
+        return NULL;
+    }
+    return &file;
+}
+
+// Loads a file of any supported format. Problems with the file itself are
+// reported and return LUA_UNKNOWN; problems with its contents throw.
+static Lua::Version LoadLuaFile(const char* path, Lua::File& file)
+{
+    ifstream  inputFile;
+    istream*  input = OpenInput(path, inputFile);
+    if (input == NULL) {
+        return Lua::LUA_UNKNOWN;
+    }
+
+    Lua::Version version = Lua::ReadAnyFile(*input, file);
+    if (version == Lua::LUA_UNKNOWN) {
+        cerr << "Input file \"" << path << "\" is not recognized as a supported Lua file" << endl;
+    }
+
+    TraceSpan span("close", path);
+    inputFile.close();
+    return version;
+}
+
+static bool SaveLuaFile(const char* path, const LuaFormat& format, const Lua::File& file)
+{
+    ofstream outputFile;
+    ostream* output = OpenOutput(path, outputFile);
+    if (output == NULL) {
+        return false;
+    }
+    format.Save(*output, file);
+
+    TraceSpan span("close", path);
+    output->flush();
+    outputFile.close();
+    return !output->fail();
+}
+
+// Verifies and optimizes a file that is about to be saved as the options say
+static void PrepareLuaFile(Lua::File& file, Lua::Version version, const Options& options)
+{
+    // The optimization passes expect valid code
+    if (options.verify || options.Optimizes()) {
+        Lua::VerifyFile(file, version);
+    }
+
+    if (options.Optimizes())
+    {
+        if (options.cacheGlobals) {
+            Lua::CacheGlobals(file, version);
+        }
+        if (options.reorderConstants) {
+            Lua::ReorderConstants(file, version);
+        }
+        if (options.minimizeStack) {
+            Lua::MinimizeStack(file, version);
         }
+        if (options.verify) {
+            Lua::VerifyFile(file, version);
+        }
+    }
+}
+
+static int Convert(const vector<const char*>& args, const Options& options)
+{
+    const char* src  = args[0];
+    const char* dest = args[1];
+
+    Lua::File file;
+    Lua::Version version = LoadLuaFile(src, file);
+    if (version == Lua::LUA_UNKNOWN) {
+        return 1;
+    }
+
+    PrepareLuaFile(file, version, options);
+
+    return SaveLuaFile(dest, *LuaFormats[version].output, file) ? 0 : 1;
+}
+
+static int Diff(const vector<const char*>& args, const Options&)
+{
+    Lua::File oldFile, newFile;
+    Lua::Version oldVersion = LoadLuaFile(args[0], oldFile);
+    Lua::Version newVersion = LoadLuaFile(args[1], newFile);
+    if (oldVersion == Lua::LUA_UNKNOWN || newVersion == Lua::LUA_UNKNOWN) {
+        return 1;
+    }
+
+    ofstream outputFile;
+    ostream* output = OpenOutput(args[2], outputFile);
+    if (output == NULL) {
+        return 1;
+    }
+    Lua::WritePatch(*output, oldFile, newFile, newVersion);
+
+    TraceSpan span("close", args[2]);
+    output->flush();
+    outputFile.close();
+    return output->fail() ? 1 : 0;
+}
+
+static int Patch(const vector<const char*>& args, const Options& options)
+{
+    Lua::File oldFile, newFile;
+    if (LoadLuaFile(args[0], oldFile) == Lua::LUA_UNKNOWN) {
+        return 1;
+    }
+
+    ifstream inputFile;
+    istream* input = OpenInput(args[1], inputFile);
+    if (input == NULL) {
+        return 1;
+    }
+    Lua::Version version = Lua::ApplyPatch(*input, oldFile, newFile);
+
+    if (options.verify) {
+        Lua::VerifyFile(newFile, version);
+    }
+
+    // The input format of a version writes that same version back
+    return SaveLuaFile(args[2], *LuaFormats[version].input, newFile) ? 0 : 1;
+}
+
+static int BuildIndex(const vector<const char*>& args, const Options&)
+{
+    ofstream outputFile;
+    ostream* output = OpenOutput(args[1], outputFile);
+    if (output == NULL) {
+        return 1;
     }
-    
-    void Save(ostream& output, const Lua::File& file) const
+
+    vector<string> errors;
+    Lua::BuildIndex(args[0], *output, errors);
+    for (size_t i = 0; i < errors.size(); i++) {
+        cerr << errors[i] << endl;
+    }
+    return 0;
+}
+
+static void PrintFunction(const Lua::IndexedFunction& function)
+{
+    cout << function.file << "\t" << function.path << "\t" << function.firstLine << "-" << function.lastLine;
+}
+
+static int FindGlobal(const vector<const char*>& args, const Options&)
+{
+    ifstream inputFile;
+    istream* input = OpenInput(args[0], inputFile);
+    if (input == NULL) {
+        return 1;
+    }
+
+    vector<Lua::GlobalUse> uses;
+    Lua::Index(*input).FindGlobal(args[1], uses);
+    for (size_t i = 0; i < uses.size(); i++)
     {
-        if (m_isNew) {
-            Lua::Lua51::WriteFile(output, file, m_isLup);
-        } else {
-            Lua::Lua50::WriteFile(output, file, m_isLup);
+        PrintFunction(uses[i].function);
+        cout << "\t" << (uses[i].reads ? "r" : "") << (uses[i].writes ? "w" : "") << endl;
+    }
+    return 0;
+}
+
+static int FindLine(const vector<const char*>& args, const Options&)
+{
+    ifstream inputFile;
+    istream* input = OpenInput(args[0], inputFile);
+    if (input == NULL) {
+        return 1;
+    }
+
+    Lua::IndexedFunction function;
+    if (!Lua::Index(*input).FindLine(args[1], atoi(args[2]), function))
+    {
+        cerr << "No function covers line " << args[2] << " of \"" << args[1] << "\"" << endl;
+        return 1;
+    }
+    PrintFunction(function);
+    cout << endl;
+    return 0;
+}
+
+static int Link(const vector<const char*>& args, const Options& options)
+{
+    const char* dest = args[0];
+
+    vector<Lua::File> files(args.size() - 1);
+    Lua::Version version = Lua::LUA_UNKNOWN;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        Lua::Version v = LoadLuaFile(args[i], files[i - 1]);
+        if (v == Lua::LUA_UNKNOWN) {
+            return 1;
+        }
+        if (i > 1 && v != version)
+        {
+            cerr << "Input file \"" << args[i] << "\" is not in the same format as the other files" << endl;
+            return 1;
         }
+        version = v;
     }
 
-public:
-    SpecificLuaFormat(bool isNew, bool isLup)
-        : m_isNew(isNew), m_isLup(isLup) 
-    {}
-};
+    Lua::File file;
+    Lua::LinkFiles(files, version, file);
+
+    PrepareLuaFile(file, version, options);
+
+    return SaveLuaFile(dest, *LuaFormats[version].output, file) ? 0 : 1;
+}
+
+static const int BENCHMARK_ITERATIONS = 5;
+
+static int Benchmark(const vector<const char*>& args, const Options& options)
+{
+    Lua::BenchmarkResult result;
+    vector<string>       errors;
+    Lua::RunBenchmark(args[0], BENCHMARK_ITERATIONS, result, errors);
+    for (size_t i = 0; i < errors.size(); i++) {
+        cerr << errors[i] << endl;
+    }
+
+    ofstream outputFile;
+    ostream* output = OpenOutput(args[1], outputFile);
+    if (output == NULL) {
+        return 1;
+    }
+    Lua::WriteBenchmark(*output, result);
+
+    if (args.size() < 3) {
+        return 0;
+    }
+
+    ifstream inputFile;
+    istream* input = OpenInput(args[2], inputFile);
+    if (input == NULL) {
+        return 1;
+    }
+    Lua::BenchmarkResult baseline;
+    Lua::ReadBenchmark(*input, baseline);
+
+    vector<Lua::Regression> regressions;
+    Lua::CompareBenchmarks(baseline, result, options.threshold / 100, regressions);
+    for (size_t i = 0; i < regressions.size(); i++)
+    {
+        const Lua::Regression& r = regressions[i];
+        cerr << "Regression in " << r.metric << ": " << r.baseline << " -> " << r.current
+             << " (" << showpos << (r.current - r.baseline) / r.baseline * 100 << noshowpos << "%)" << endl;
+    }
+    return regressions.empty() ? 0 : 1;
+}
+
+static int Scan(const vector<const char*>& args, const Options&)
+{
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<Lua::ScanEntry> entries;
+    Lua::ScanFiles(args[0], entries);
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ofstream outputFile;
+    ostream* output = OpenOutput(args[1], outputFile);
+    if (output == NULL) {
+        return 1;
+    }
+    Lua::WriteScan(*output, entries);
+
+    Lua::WriteScanSummary(cerr, entries);
+    cerr << entries.size() << " files in " << seconds << " s";
+    if (seconds > 0) {
+        cerr << " (" << (size_t)(entries.size() / seconds) << " files/s)";
+    }
+    cerr << endl;
+    return 0;
+}
+
+static int Batch(const vector<const char*>& args, const Options& options)
+{
+    vector<Lua::ManifestEntry> entries;
+    vector<string>             errors;
+    Lua::RunBatch(args[0], args[1], options.shard, options.nShards,
+                  [&](Lua::File& file, Lua::Version version) { PrepareLuaFile(file, version, options); },
+                  entries, errors);
+    for (size_t i = 0; i < errors.size(); i++) {
+        cerr << errors[i] << endl;
+    }
+
+    ofstream outputFile;
+    ostream* output = OpenOutput(args[2], outputFile);
+    if (output == NULL) {
+        return 1;
+    }
+    Lua::WriteManifest(*output, entries);
+    return errors.empty() ? 0 : 1;
+}
+
+static int MergeManifests(const vector<const char*>& args, const Options&)
+{
+    vector<Lua::ManifestEntry> entries;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        ifstream inputFile;
+        istream* input = OpenInput(args[i], inputFile);
+        if (input == NULL) {
+            return 1;
+        }
+        Lua::ReadManifest(*input, entries);
+    }
+    Lua::MergeManifests(entries);
+
+    ofstream outputFile;
+    ostream* output = OpenOutput(args[0], outputFile);
+    if (output == NULL) {
+        return 1;
+    }
+    Lua::WriteManifest(*output, entries);
+    return 0;
+}
+
+static int Carve(const vector<const char*>& args, const Options& options)
+{
+    const Lua::PrepareFunction prepare = [&](Lua::File& file, Lua::Version version) { PrepareLuaFile(file, version, options); };
+
+    vector<Lua::CarvedChunk> chunks;
+    vector<string>           errors;
+    Lua::CarveFile(args[0], args[1], options.convert ? &prepare : NULL, chunks, errors);
+    for (size_t i = 0; i < errors.size(); i++) {
+        cerr << errors[i] << endl;
+    }
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        const Lua::CarvedChunk& chunk = chunks[i];
+        cout << chunk.file << "\t" << chunk.offset << "\t" << chunk.size << endl;
+    }
+    return errors.empty() ? 0 : 1;
+}
+
+static int Analyze(const vector<const char*>& args, const Options&)
+{
+    Lua::SizeReport report;
+    vector<string>  errors;
+    Lua::AnalyzeCorpus(args[0], report, errors);
+    for (size_t i = 0; i < errors.size(); i++) {
+        cerr << errors[i] << endl;
+    }
+
+    ofstream outputFile;
+    ostream* output = OpenOutput(args[1], outputFile);
+    if (output == NULL) {
+        return 1;
+    }
+    Lua::WriteSizeReport(*output, report);
+    return 0;
+}
+
+// Parses "<i>/<n>" with 1 <= i <= n into a zero-based shard
+static bool ParseShard(const char* str, Options& options)
+{
+    char* end;
+    const long shard = strtol(str, &end, 10);
+    if (*end != '/') {
+        return false;
+    }
+    const long nShards = strtol(end + 1, &end, 10);
+    if (*end != '\0' || nShards < 1 || nShards > 4096 || shard < 1 || shard > nShards) {
+        return false;
+    }
+    options.shard   = (int)shard - 1;
+    options.nShards = (int)nShards;
+    return true;
+}
 
-static const SpecificLuaFormat g_FormatLua50 (false, false);
-static const SpecificLuaFormat g_FormatLua51 (true,  false);
-static const SpecificLuaFormat g_FormatLupEaW(false, true);
-static const SpecificLuaFormat g_FormatLupUaW(true,  true);
+typedef int (*Command)(const vector<const char*>& args, const Options& options);
 
 static const struct {
-    const LuaFormat* input;
-    const LuaFormat* output;
-} LuaFormats[] = {
-    {&g_FormatLua50,  &g_FormatLupEaW},
-    {&g_FormatLua51,  &g_FormatLupUaW},
-    {&g_FormatLupEaW, &g_FormatLua50},
-    {&g_FormatLupUaW, &g_FormatLua51},
-    {NULL}
+    const char* name;
+    size_t      minArgs;
+    size_t      maxArgs;
+    Command     command;
+} Commands[] = {
+    {"diff",            3, 3,        Diff},
+    {"patch",           3, 3,        Patch},
+    {"index",           2, 2,        BuildIndex},
+    {"find-global",     2, 2,        FindGlobal},
+    {"find-line",       3, 3,        FindLine},
+    {"link",            2, SIZE_MAX, Link},
+    {"bench",           2, 3,        Benchmark},
+    {"scan",            2, 2,        Scan},
+    {"batch",           3, 3,        Batch},
+    {"merge-manifests", 2, SIZE_MAX, MergeManifests},
+    {"carve",           2, 2,        Carve},
+    {"analyze",         2, 2,        Analyze},
+    {NULL, 0, 0, NULL}
 };
 
 int main(int argc, char* argv[])
 {
     // Parse the arguments
-	if (argc != 3)
+    Command command = Convert;
+    size_t  minArgs = 2;
+    size_t  maxArgs = 2;
+    int     first   = 1;
+    for (int i = 0; argc > 1 && Commands[i].name != NULL; i++)
+    {
+        if (strcmp(argv[1], Commands[i].name) == 0) {
+            command = Commands[i].command;
+            minArgs = Commands[i].minArgs;
+            maxArgs = Commands[i].maxArgs;
+            first   = 2;
+        }
+    }
+
+    Options options;
+    vector<const char*> args;
+    for (int i = first; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-verify") == 0) {
+            options.verify = false;
+        } else if (strcmp(argv[i], "--minimize-stack") == 0) {
+            options.minimizeStack = true;
+        } else if (strcmp(argv[i], "--cache-globals") == 0) {
+            options.cacheGlobals = true;
+        } else if (strcmp(argv[i], "--reorder-constants") == 0) {
+            options.reorderConstants = true;
+        } else if (strcmp(argv[i], "--convert") == 0) {
+            options.convert = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            options.trace = argv[++i];
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc && ParseShard(argv[i + 1], options)) {
+            i++;
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            options.threshold = atof(argv[++i]);
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            PrintUsage();
+            return 1;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+
+	if (args.size() < minArgs || args.size() > maxArgs)
 	{
-		cerr << "Lup/Lua converter 1.1, by Mike Lankamp." << endl
-		     << "Syntax: luacvt <src-file> <dest-file>" << endl
-             << endl
-             << "The program will read a Lua or Lup file and convert it to a Lup or Lua file." << endl
-             << "The format of the source file is automatically detected and the appropriate" << endl
-             << "destination format selected. EaW/FoC Luas will be converted to Lua 5.0 files" << endl
-             << "and vica versa. UaW Luas will be converted to Lua 5.1 files and vica versa." << endl;
+        PrintUsage();
         return 1;
 	}
 
-    const char* src  = argv[1];
-    const char* dest = argv[2];
+    if (options.trace != NULL) {
+        StartTrace();
+    }
 
+    int result = 1;
 #ifdef NDEBUG
 	try
 #endif
 	{
-		ifstream input(src, ios_base::binary | ios_base::in);
-		if (!input.is_open())
-		{
-			cerr << "Unable to open input file \"" << src << "\"" << endl;
-            return 1;
-		}
-
-        Lua::Version version = Lua::DetectFileVersion(input);
-        if (version == Lua::LUA_UNKNOWN)
-        {
-            cerr << "Input file is not recognized as a supported Lua file" << endl;
-            return 1;
-        }
-
-        Lua::File file;
-        LuaFormats[version].input->Load(input, file);
-        input.close();
-
-		ofstream output(dest, ios_base::binary | ios_base::out);
-		if (!output.is_open())
-		{
-			cerr << "Unable to open output file \"" << dest << "\"" << endl;
-            return 1;
-		}
-
-        LuaFormats[version].output->Save(output, file);
+        result = command(args, options);
 	}
 #ifdef NDEBUG
 	catch (exception& e)
 	{
 		cerr << e.what() << endl;
-        return 1;
 	}
 #endif
-	return 0;
-}
\ No newline at end of file
+
+    if (options.trace != NULL)
+    {
+        ofstream trace(options.trace, ios_base::out);
+        if (!trace.is_open())
+        {
+            cerr << "Unable to open trace file \"" << options.trace << "\"" << endl;
+            return 1;
+        }
+        WriteTrace(trace);
+    }
+    return result;
+}
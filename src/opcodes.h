@@ -0,0 +1,360 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+// Instruction layouts and opcode tables of the Lua 5.0 and 5.1 virtual machines
+
+#include <array>
+#include <vector>
+#include "lua.h"
+
+namespace Lua
+{
+
+// Opcodes of both versions, numbered independently of either
+enum OpCode
+{
+    OP_MOVE,
+    OP_LOADK,
+    OP_LOADBOOL,
+    OP_LOADNIL,
+    OP_GETUPVAL,
+    OP_GETGLOBAL,
+    OP_GETTABLE,
+    OP_SETGLOBAL,
+    OP_SETUPVAL,
+    OP_SETTABLE,
+    OP_NEWTABLE,
+    OP_SELF,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,         // 5.1 only
+    OP_POW,
+    OP_UNM,
+    OP_NOT,
+    OP_LEN,         // 5.1 only
+    OP_CONCAT,
+    OP_JMP,
+    OP_EQ,
+    OP_LT,
+    OP_LE,
+    OP_TEST,
+    OP_TESTSET,     // 5.1 only
+    OP_CALL,
+    OP_TAILCALL,
+    OP_RETURN,
+    OP_FORLOOP,
+    OP_FORPREP,     // 5.1 only
+    OP_TFORLOOP,
+    OP_TFORPREP,    // 5.0 only
+    OP_SETLIST,
+    OP_SETLISTO,    // 5.0 only
+    OP_CLOSE,
+    OP_CLOSURE,
+    OP_VARARG,      // 5.1 only
+    OP_INVALID
+};
+
+enum OpMode
+{
+    iABC,
+    iABx,
+    iAsBx
+};
+
+enum OpArgMode
+{
+    OpArgN,     // argument is not used
+    OpArgU,     // argument is a count, flag or index into something else
+    OpArgR,     // argument is a register (or a jump offset for iAsBx)
+    OpArgK,     // argument is a constant (Bx) or a register/constant (B, C)
+};
+
+struct OpInfo
+{
+    const char* name;
+    OpCode      op;
+    OpMode      mode;
+    OpArgMode   a;
+    OpArgMode   b;
+    OpArgMode   c;
+    bool        test;   // may skip the next instruction
+};
+
+// Operand extraction for a layout; the opcode is always the low six bits
+template <int POS_A, int POS_B, int POS_C, int POS_BX>
+struct InstructionLayout
+{
+    static constexpr int MAXARG_sBx = (1 << 18) / 2 - 1;
+
+    static constexpr int GetOpcode(Instruction i) { return (int)(i & 0x3F); }
+    static constexpr int GetA     (Instruction i) { return (int)((i >> POS_A)  & 0xFF); }
+    static constexpr int GetB     (Instruction i) { return (int)((i >> POS_B)  & 0x1FF); }
+    static constexpr int GetC     (Instruction i) { return (int)((i >> POS_C)  & 0x1FF); }
+    static constexpr int GetBx    (Instruction i) { return (int)((i >> POS_BX) & 0x3FFFF); }
+    static constexpr int GetSBx   (Instruction i) { return GetBx(i) - MAXARG_sBx; }
+
+    static constexpr Instruction SetA (Instruction i, int a)  { return (i & ~((Instruction)0xFF    << POS_A))  | ((Instruction)a  << POS_A); }
+    static constexpr Instruction SetB (Instruction i, int b)  { return (i & ~((Instruction)0x1FF   << POS_B))  | ((Instruction)b  << POS_B); }
+    static constexpr Instruction SetC (Instruction i, int c)  { return (i & ~((Instruction)0x1FF   << POS_C))  | ((Instruction)c  << POS_C); }
+    static constexpr Instruction SetBx(Instruction i, int bx) { return (i & ~((Instruction)0x3FFFF << POS_BX)) | ((Instruction)bx << POS_BX); }
+
+    static constexpr Instruction CreateABC(int opcode, int a, int b, int c)
+    {
+        return (Instruction)opcode | ((Instruction)a << POS_A) | ((Instruction)b << POS_B) | ((Instruction)c << POS_C);
+    }
+
+    static constexpr Instruction CreateABx(int opcode, int a, int bx)
+    {
+        return (Instruction)opcode | ((Instruction)a << POS_A) | ((Instruction)bx << POS_BX);
+    }
+
+    static constexpr Instruction CreateAsBx(int opcode, int a, int sbx)
+    {
+        return CreateABx(opcode, a, sbx + MAXARG_sBx);
+    }
+};
+
+namespace Lua50
+{
+    struct Layout : public InstructionLayout<24, 15, 6, 6>
+    {
+        static constexpr int  NUM_OPCODES = 35;
+        static constexpr bool IsNew       = false;
+
+        // Registers are below MAXSTACK, constants are stored above it
+        static constexpr int  MAXSTACK    = 250;
+        static constexpr bool IsConstant(int rk)      { return rk >= MAXSTACK; }
+        static constexpr int  ConstantIndex(int rk)   { return rk - MAXSTACK; }
+        static constexpr int  RKConstant(int index)   { return index + MAXSTACK; }
+        static constexpr int  MAXINDEXRK  = 0x1FF - MAXSTACK;
+
+        static constexpr OpInfo OpInfos[NUM_OPCODES] = {
+        {"MOVE",      OP_MOVE,      iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"LOADK",     OP_LOADK,     iABx,  OpArgR, OpArgK, OpArgN, false},
+        {"LOADBOOL",  OP_LOADBOOL,  iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"LOADNIL",   OP_LOADNIL,   iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"GETUPVAL",  OP_GETUPVAL,  iABC,  OpArgR, OpArgU, OpArgN, false},
+        {"GETGLOBAL", OP_GETGLOBAL, iABx,  OpArgR, OpArgK, OpArgN, false},
+        {"GETTABLE",  OP_GETTABLE,  iABC,  OpArgR, OpArgR, OpArgK, false},
+        {"SETGLOBAL", OP_SETGLOBAL, iABx,  OpArgR, OpArgK, OpArgN, false},
+        {"SETUPVAL",  OP_SETUPVAL,  iABC,  OpArgR, OpArgU, OpArgN, false},
+        {"SETTABLE",  OP_SETTABLE,  iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"NEWTABLE",  OP_NEWTABLE,  iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"SELF",      OP_SELF,      iABC,  OpArgR, OpArgR, OpArgK, false},
+        {"ADD",       OP_ADD,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"SUB",       OP_SUB,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"MUL",       OP_MUL,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"DIV",       OP_DIV,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"POW",       OP_POW,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"UNM",       OP_UNM,       iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"NOT",       OP_NOT,       iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"CONCAT",    OP_CONCAT,    iABC,  OpArgR, OpArgR, OpArgR, false},
+        {"JMP",       OP_JMP,       iAsBx, OpArgN, OpArgR, OpArgN, false},
+        {"EQ",        OP_EQ,        iABC,  OpArgU, OpArgK, OpArgK, true },
+        {"LT",        OP_LT,        iABC,  OpArgU, OpArgK, OpArgK, true },
+        {"LE",        OP_LE,        iABC,  OpArgU, OpArgK, OpArgK, true },
+        {"TEST",      OP_TEST,      iABC,  OpArgR, OpArgR, OpArgU, true },
+        {"CALL",      OP_CALL,      iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"TAILCALL",  OP_TAILCALL,  iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"RETURN",    OP_RETURN,    iABC,  OpArgR, OpArgU, OpArgN, false},
+        {"FORLOOP",   OP_FORLOOP,   iAsBx, OpArgR, OpArgR, OpArgN, false},
+        {"TFORLOOP",  OP_TFORLOOP,  iABC,  OpArgR, OpArgN, OpArgU, true },
+        {"TFORPREP",  OP_TFORPREP,  iAsBx, OpArgR, OpArgR, OpArgN, false},
+        {"SETLIST",   OP_SETLIST,   iABx,  OpArgR, OpArgU, OpArgN, false},
+        {"SETLISTO",  OP_SETLISTO,  iABx,  OpArgR, OpArgU, OpArgN, false},
+        {"CLOSE",     OP_CLOSE,     iABC,  OpArgR, OpArgN, OpArgN, false},
+        {"CLOSURE",   OP_CLOSURE,   iABx,  OpArgR, OpArgU, OpArgN, false},
+        };
+    };
+}
+
+namespace Lua51
+{
+    struct Layout : public InstructionLayout<6, 23, 14, 14>
+    {
+        static constexpr int  NUM_OPCODES = 38;
+        static constexpr bool IsNew       = true;
+
+        // Constants have the high bit of the argument set
+        static constexpr int  MAXSTACK    = 250;
+        static constexpr bool IsConstant(int rk)      { return (rk & 0x100) != 0; }
+        static constexpr int  ConstantIndex(int rk)   { return rk & 0xFF; }
+        static constexpr int  RKConstant(int index)   { return index | 0x100; }
+        static constexpr int  MAXINDEXRK  = 0xFF;
+
+        static constexpr OpInfo OpInfos[NUM_OPCODES] = {
+        {"MOVE",      OP_MOVE,      iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"LOADK",     OP_LOADK,     iABx,  OpArgR, OpArgK, OpArgN, false},
+        {"LOADBOOL",  OP_LOADBOOL,  iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"LOADNIL",   OP_LOADNIL,   iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"GETUPVAL",  OP_GETUPVAL,  iABC,  OpArgR, OpArgU, OpArgN, false},
+        {"GETGLOBAL", OP_GETGLOBAL, iABx,  OpArgR, OpArgK, OpArgN, false},
+        {"GETTABLE",  OP_GETTABLE,  iABC,  OpArgR, OpArgR, OpArgK, false},
+        {"SETGLOBAL", OP_SETGLOBAL, iABx,  OpArgR, OpArgK, OpArgN, false},
+        {"SETUPVAL",  OP_SETUPVAL,  iABC,  OpArgR, OpArgU, OpArgN, false},
+        {"SETTABLE",  OP_SETTABLE,  iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"NEWTABLE",  OP_NEWTABLE,  iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"SELF",      OP_SELF,      iABC,  OpArgR, OpArgR, OpArgK, false},
+        {"ADD",       OP_ADD,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"SUB",       OP_SUB,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"MUL",       OP_MUL,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"DIV",       OP_DIV,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"MOD",       OP_MOD,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"POW",       OP_POW,       iABC,  OpArgR, OpArgK, OpArgK, false},
+        {"UNM",       OP_UNM,       iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"NOT",       OP_NOT,       iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"LEN",       OP_LEN,       iABC,  OpArgR, OpArgR, OpArgN, false},
+        {"CONCAT",    OP_CONCAT,    iABC,  OpArgR, OpArgR, OpArgR, false},
+        {"JMP",       OP_JMP,       iAsBx, OpArgN, OpArgR, OpArgN, false},
+        {"EQ",        OP_EQ,        iABC,  OpArgU, OpArgK, OpArgK, true },
+        {"LT",        OP_LT,        iABC,  OpArgU, OpArgK, OpArgK, true },
+        {"LE",        OP_LE,        iABC,  OpArgU, OpArgK, OpArgK, true },
+        {"TEST",      OP_TEST,      iABC,  OpArgR, OpArgN, OpArgU, true },
+        {"TESTSET",   OP_TESTSET,   iABC,  OpArgR, OpArgR, OpArgU, true },
+        {"CALL",      OP_CALL,      iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"TAILCALL",  OP_TAILCALL,  iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"RETURN",    OP_RETURN,    iABC,  OpArgR, OpArgU, OpArgN, false},
+        {"FORLOOP",   OP_FORLOOP,   iAsBx, OpArgR, OpArgR, OpArgN, false},
+        {"FORPREP",   OP_FORPREP,   iAsBx, OpArgR, OpArgR, OpArgN, false},
+        {"TFORLOOP",  OP_TFORLOOP,  iABC,  OpArgR, OpArgN, OpArgU, true },
+        {"SETLIST",   OP_SETLIST,   iABC,  OpArgR, OpArgU, OpArgU, false},
+        {"CLOSE",     OP_CLOSE,     iABC,  OpArgR, OpArgN, OpArgN, false},
+        {"CLOSURE",   OP_CLOSURE,   iABx,  OpArgR, OpArgU, OpArgN, false},
+        {"VARARG",    OP_VARARG,    iABC,  OpArgR, OpArgU, OpArgN, false},
+        };
+    };
+}
+
+//
+// Opcode lookup tables, built at compile time from OpInfos. Every six-bit
+// opcode has an entry so decoding needs no range check.
+//
+
+template <typename Layout>
+constexpr std::array<OpCode, 64> MakeOpCodeTable()
+{
+    std::array<OpCode, 64> table = {};
+    for (int i = 0; i < 64; i++) {
+        table[i] = (i < Layout::NUM_OPCODES) ? Layout::OpInfos[i].op : OP_INVALID;
+    }
+    return table;
+}
+
+template <typename Layout>
+constexpr std::array<int, OP_INVALID + 1> MakeOpcodeNumberTable()
+{
+    std::array<int, OP_INVALID + 1> table = {};
+    for (int i = 0; i <= OP_INVALID; i++) {
+        table[i] = -1;
+    }
+    for (int i = 0; i < Layout::NUM_OPCODES; i++) {
+        table[Layout::OpInfos[i].op] = i;
+    }
+    return table;
+}
+
+template <typename Layout>
+inline constexpr std::array<OpCode, 64> OpCodeTable = MakeOpCodeTable<Layout>();
+
+template <typename Layout>
+inline constexpr std::array<int, OP_INVALID + 1> OpcodeNumberTable = MakeOpcodeNumberTable<Layout>();
+
+// Returns the number of the opcode in a layout, or -1 if its version lacks it
+template <typename Layout>
+constexpr int GetOpcodeNumber(OpCode op)
+{
+    return OpcodeNumberTable<Layout>[op];
+}
+
+//
+// Typed view of a single instruction. It holds only the encoded word; every
+// field is extracted on access with the layout's constant shifts and masks.
+//
+template <typename Layout>
+class InstructionView
+{
+    Instruction m_value;
+
+public:
+    constexpr OpCode Op()     const { return OpCodeTable<Layout>[Layout::GetOpcode(m_value)]; }
+    constexpr int    Opcode() const { return Layout::GetOpcode(m_value); }
+    constexpr int    A()      const { return Layout::GetA(m_value); }
+    constexpr int    B()      const { return Layout::GetB(m_value); }
+    constexpr int    C()      const { return Layout::GetC(m_value); }
+    constexpr int    Bx()     const { return Layout::GetBx(m_value); }
+    constexpr int    SBx()    const { return Layout::GetSBx(m_value); }
+
+    constexpr bool   IsValid() const { return Op() != OP_INVALID; }
+
+    // Only valid for valid opcodes
+    constexpr const OpInfo& Info() const { return Layout::OpInfos[Opcode()]; }
+
+    constexpr Instruction Value() const { return m_value; }
+
+    constexpr explicit InstructionView(Instruction value) : m_value(value) {}
+};
+
+// Iterable view of a function's code that yields InstructionViews
+template <typename Layout>
+class CodeView
+{
+    const Instruction* m_begin;
+    const Instruction* m_end;
+
+public:
+    class Iterator
+    {
+        const Instruction* m_pos;
+
+    public:
+        InstructionView<Layout> operator*() const { return InstructionView<Layout>(*m_pos); }
+        Iterator& operator++() { ++m_pos; return *this; }
+        bool operator!=(const Iterator& other) const { return m_pos != other.m_pos; }
+
+        explicit Iterator(const Instruction* pos) : m_pos(pos) {}
+    };
+
+    Iterator begin() const { return Iterator(m_begin); }
+    Iterator end()   const { return Iterator(m_end); }
+    size_t   size()  const { return m_end - m_begin; }
+
+    InstructionView<Layout> operator[](size_t pc) const { return InstructionView<Layout>(m_begin[pc]); }
+
+    explicit CodeView(const std::vector<Instruction>& code)
+        : m_begin(code.data()), m_end(code.data() + code.size()) {}
+};
+
+// An instruction with every field extracted, for analyses that look at each
+// instruction more than once
+struct DecodedInstruction
+{
+    OpCode op;
+    int    a;
+    int    b;
+    int    c;
+    int    bx;
+    int    sbx;
+};
+
+// Decodes a whole array in one tight loop without branches
+template <typename Layout>
+void DecodeAll(const std::vector<Instruction>& code, std::vector<DecodedInstruction>& decoded)
+{
+    decoded.resize(code.size());
+    const Instruction*  src = code.data();
+    DecodedInstruction* dst = decoded.data();
+    for (size_t i = 0, n = code.size(); i < n; i++)
+    {
+        const Instruction value = src[i];
+        dst[i].op  = OpCodeTable<Layout>[Layout::GetOpcode(value)];
+        dst[i].a   = Layout::GetA(value);
+        dst[i].b   = Layout::GetB(value);
+        dst[i].c   = Layout::GetC(value);
+        dst[i].bx  = Layout::GetBx(value);
+        dst[i].sbx = Layout::GetSBx(value);
+    }
+}
+
+}
+#endif
@@ -0,0 +1,420 @@
+#include <cstring>
+#include <map>
+#include "lua_io.h"
+#include "hash.h"
+#include "exceptions.h"
+using namespace std;
+
+namespace Lua {
+
+//
+// Function-level patches
+//
+// A patch describes the function tree of the new chunk in preorder. Each
+// function is either taken as a whole subtree from the old chunk, takes only
+// its own body from the old chunk and describes its nested functions, or is
+// stored in full. Unchanged functions therefore cost a few bytes and applying
+// the patch is mostly copying the old arrays.
+//
+
+// Patch header
+#pragma pack(1)
+struct Header
+{
+    char          signature[4];
+    unsigned char patchVersion;
+    unsigned char version;          // Version of the new chunk
+    uint64_t      baseHash;         // Subtree hash of the old main function
+};
+#pragma pack()
+
+static const char          PATCH_SIGNATURE[4] = {'\033', 'L', 'd', 'p'};
+static const unsigned char PATCH_VERSION      = 1;
+static const int           MAX_PATCH_DEPTH    = 200;   // Nesting limit of the Lua parsers
+
+enum PatchOp
+{
+    PATCH_FULL,                     // Body and nested functions follow
+    PATCH_BODY,                     // Old function index, nested functions follow
+    PATCH_SUBTREE,                  // Old function index
+};
+
+// A function of a chunk in preorder, with its hashes
+struct FunctionEntry
+{
+    const Function* function;
+    uint64_t        bodyHash;
+    uint64_t        treeHash;
+    size_t          end;            // Index past the last nested function
+};
+
+static uint64_t HashBody(const Function& function)
+{
+    Hash hash;
+    hash.Add(function.name);
+    hash.Add((uint64_t)function.lineDefined);
+    hash.Add((uint64_t)function.lastLineDefined);
+    hash.Add((uint64_t)function.nUpvalues);
+    hash.Add((uint64_t)function.nParameters);
+    hash.Add((uint64_t)function.isVararg);
+    hash.Add((uint64_t)function.maxStackSize);
+    hash.Add((uint64_t)function.lines.size());
+    for (size_t i = 0; i < function.lines.size(); i++) {
+        hash.Add((uint64_t)function.lines[i]);
+    }
+    hash.Add((uint64_t)function.locals.size());
+    for (size_t i = 0; i < function.locals.size(); i++) {
+        hash.Add(function.locals[i].name);
+        hash.Add((uint64_t)function.locals[i].startPC);
+        hash.Add((uint64_t)function.locals[i].endPC);
+    }
+    hash.Add((uint64_t)function.upvalues.size());
+    for (size_t i = 0; i < function.upvalues.size(); i++) {
+        hash.Add(function.upvalues[i]);
+    }
+    hash.Add((uint64_t)function.constants.size());
+    for (size_t i = 0; i < function.constants.size(); i++)
+    {
+        const Constant& constant = function.constants[i];
+        hash.Add((uint64_t)constant.type);
+        switch (constant.type)
+        {
+            case TNUMBER:  hash.Add(&constant.number, sizeof constant.number); break;
+            case TSTRING:  hash.Add(constant.str); break;
+            case TBOOLEAN: hash.Add((uint64_t)constant.boolean); break;
+            default:       break;
+        }
+    }
+    hash.Add((uint64_t)function.instructions.size());
+    for (size_t i = 0; i < function.instructions.size(); i++) {
+        hash.Add((uint64_t)function.instructions[i]);
+    }
+    return hash.Value();
+}
+
+// Appends the function and its nested functions in preorder; returns the subtree hash
+static uint64_t IndexFunctions(const Function& function, vector<FunctionEntry>& entries)
+{
+    size_t index = entries.size();
+    entries.push_back(FunctionEntry());
+    entries[index].function = &function;
+    entries[index].bodyHash = HashBody(function);
+
+    Hash hash;
+    hash.Add(entries[index].bodyHash);
+    hash.Add((uint64_t)function.functions.size());
+    for (size_t i = 0; i < function.functions.size(); i++) {
+        hash.Add(IndexFunctions(function.functions[i], entries));
+    }
+    entries[index].treeHash = hash.Value();
+    entries[index].end      = entries.size();
+    return entries[index].treeHash;
+}
+
+static bool SameBody(const Function& a, const Function& b)
+{
+    if (a.name != b.name || a.lineDefined != b.lineDefined || a.lastLineDefined != b.lastLineDefined ||
+        a.nUpvalues != b.nUpvalues || a.nParameters != b.nParameters || a.isVararg != b.isVararg ||
+        a.maxStackSize != b.maxStackSize || a.lines != b.lines || a.upvalues != b.upvalues ||
+        a.instructions != b.instructions || a.locals.size() != b.locals.size() ||
+        a.constants.size() != b.constants.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < a.locals.size(); i++)
+    {
+        if (a.locals[i].name != b.locals[i].name || a.locals[i].startPC != b.locals[i].startPC ||
+            a.locals[i].endPC != b.locals[i].endPC) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a.constants.size(); i++)
+    {
+        const Constant& x = a.constants[i];
+        const Constant& y = b.constants[i];
+        if (x.type != y.type ||
+            (x.type == TNUMBER  && memcmp(&x.number, &y.number, sizeof x.number) != 0) ||
+            (x.type == TSTRING  && x.str != y.str) ||
+            (x.type == TBOOLEAN && x.boolean != y.boolean)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool SameTree(const Function& a, const Function& b)
+{
+    if (!SameBody(a, b) || a.functions.size() != b.functions.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.functions.size(); i++) {
+        if (!SameTree(a.functions[i], b.functions[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//
+// Writing
+//
+
+struct PatchIndex
+{
+    vector<FunctionEntry>    entries;
+    multimap<uint64_t, int>  bodies;
+    multimap<uint64_t, int>  trees;
+};
+
+// Finds an old function with the given hash whose contents really match
+static int FindMatch(const PatchIndex& index, const multimap<uint64_t, int>& map, uint64_t hash,
+                     const Function& function, bool (*same)(const Function&, const Function&))
+{
+    typedef multimap<uint64_t, int>::const_iterator Iterator;
+    pair<Iterator, Iterator> range = map.equal_range(hash);
+    for (Iterator p = range.first; p != range.second; ++p) {
+        if (same(*index.entries[p->second].function, function)) {
+            return p->second;
+        }
+    }
+    return -1;
+}
+
+static void WriteBody(Writer& writer, const Function& function)
+{
+    writer.WriteString(function.name);
+    writer.WriteInt(function.lineDefined);
+    writer.WriteInt(function.lastLineDefined);
+    writer.WriteByte(function.nUpvalues);
+    writer.WriteByte(function.nParameters);
+    writer.WriteByte(function.isVararg);
+    writer.WriteByte(function.maxStackSize);
+
+    writer.WriteInt((int)function.lines.size());
+    for (size_t i = 0; i < function.lines.size(); i++) {
+        writer.WriteInt(function.lines[i]);
+    }
+    writer.WriteInt((int)function.locals.size());
+    for (size_t i = 0; i < function.locals.size(); i++) {
+        writer.WriteString(function.locals[i].name);
+        writer.WriteInt(function.locals[i].startPC);
+        writer.WriteInt(function.locals[i].endPC);
+    }
+    writer.WriteInt((int)function.upvalues.size());
+    for (size_t i = 0; i < function.upvalues.size(); i++) {
+        writer.WriteString(function.upvalues[i]);
+    }
+    writer.WriteInt((int)function.constants.size());
+    for (size_t i = 0; i < function.constants.size(); i++)
+    {
+        const Constant& constant = function.constants[i];
+        writer.WriteByte(constant.type);
+        switch (constant.type)
+        {
+            case TNUMBER:  writer.WriteNumber<double>(constant.number); break;
+            case TSTRING:  writer.WriteString(constant.str); break;
+            case TBOOLEAN: writer.WriteByte(constant.boolean ? 1 : 0); break;
+            default:       break;
+        }
+    }
+    writer.WriteInt((int)function.instructions.size());
+    for (size_t i = 0; i < function.instructions.size(); i++) {
+        writer.WriteInt((int)function.instructions[i]);
+    }
+}
+
+static void WritePatchFunction(Writer& writer, const PatchIndex& index, const vector<FunctionEntry>& entries, size_t& current)
+{
+    const FunctionEntry& entry    = entries[current++];
+    const Function&      function = *entry.function;
+
+    int match = FindMatch(index, index.trees, entry.treeHash, function, SameTree);
+    if (match >= 0)
+    {
+        writer.WriteByte(PATCH_SUBTREE);
+        writer.WriteInt(match);
+
+        current = entry.end;
+        return;
+    }
+
+    match = FindMatch(index, index.bodies, entry.bodyHash, function, SameBody);
+    if (match >= 0) {
+        writer.WriteByte(PATCH_BODY);
+        writer.WriteInt(match);
+    } else {
+        writer.WriteByte(PATCH_FULL);
+        WriteBody(writer, function);
+    }
+
+    writer.WriteInt((int)function.functions.size());
+    for (size_t i = 0; i < function.functions.size(); i++) {
+        WritePatchFunction(writer, index, entries, current);
+    }
+}
+
+void WritePatch(ostream& output, const File& oldFile, const File& newFile, Version version)
+{
+    PatchIndex index;
+    uint64_t baseHash = IndexFunctions(oldFile.function, index.entries);
+    for (size_t i = 0; i < index.entries.size(); i++)
+    {
+        index.bodies.insert(make_pair(index.entries[i].bodyHash, (int)i));
+        index.trees .insert(make_pair(index.entries[i].treeHash, (int)i));
+    }
+
+    vector<FunctionEntry> entries;
+    IndexFunctions(newFile.function, entries);
+
+    Header header;
+    memcpy(header.signature, PATCH_SIGNATURE, 4);
+    header.patchVersion = PATCH_VERSION;
+    header.version      = (unsigned char)version;
+    header.baseHash     = htolell(baseHash);
+
+    Writer writer(output);
+    writer.Write(&header, sizeof header);
+
+    size_t current = 0;
+    WritePatchFunction(writer, index, entries, current);
+}
+
+//
+// Reading
+//
+
+static void ReadBody(Reader& reader, Function& function)
+{
+    function.name            = reader.ReadString();
+    function.lineDefined     = reader.ReadInt();
+    function.lastLineDefined = reader.ReadInt();
+    function.nUpvalues       = reader.ReadByte();
+    function.nParameters     = reader.ReadByte();
+    function.isVararg        = reader.ReadByte();
+    function.maxStackSize    = reader.ReadByte();
+
+    size_t count = reader.ReadCount(sizeof(int));
+    reader.Reserve(function.lines, count);
+    for (size_t i = 0; i < count; i++) {
+        function.lines.push_back(reader.ReadInt());
+    }
+
+    count = reader.ReadCount(3 * sizeof(int));
+    reader.Reserve(function.locals, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        function.locals.push_back(Local());
+        Local& local = function.locals.back();
+        local.name    = reader.ReadString();
+        local.startPC = reader.ReadInt();
+        local.endPC   = reader.ReadInt();
+    }
+
+    count = reader.ReadCount(sizeof(int));
+    reader.Reserve(function.upvalues, count);
+    for (size_t i = 0; i < count; i++) {
+        function.upvalues.push_back(reader.ReadString());
+    }
+
+    count = reader.ReadCount(1);
+    reader.Reserve(function.constants, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        function.constants.push_back(Constant());
+        Constant& constant = function.constants.back();
+        constant.type = (Type)reader.ReadByte();
+        switch (constant.type)
+        {
+            case TNUMBER:  constant.number  = reader.ReadNumber<double>(); break;
+            case TSTRING:  constant.str     = reader.ReadString(); break;
+            case TBOOLEAN: constant.boolean = reader.ReadByte() != 0; break;
+            case TNIL:     break;
+            default:
+                throw BadFileException();
+        }
+    }
+
+    count = reader.ReadCount(sizeof(int));
+    reader.Reserve(function.instructions, count);
+    for (size_t i = 0; i < count; i++) {
+        function.instructions.push_back((unsigned int)reader.ReadInt());
+    }
+}
+
+static const Function& GetOldFunction(const vector<FunctionEntry>& entries, int index)
+{
+    if (index < 0 || (size_t)index >= entries.size()) {
+        throw BadFileException();
+    }
+    return *entries[index].function;
+}
+
+static void ReadPatchFunction(Reader& reader, const vector<FunctionEntry>& entries, Function& function, int depth)
+{
+    // Deeper trees than the compilers produce would only exhaust our stack
+    if (depth > MAX_PATCH_DEPTH) {
+        throw BadFileException();
+    }
+
+    switch (reader.ReadByte())
+    {
+        case PATCH_SUBTREE:
+            function = GetOldFunction(entries, reader.ReadInt());
+            return;
+
+        case PATCH_BODY:
+        {
+            const Function& old = GetOldFunction(entries, reader.ReadInt());
+            function.name            = old.name;
+            function.lineDefined     = old.lineDefined;
+            function.lastLineDefined = old.lastLineDefined;
+            function.nUpvalues       = old.nUpvalues;
+            function.nParameters     = old.nParameters;
+            function.isVararg        = old.isVararg;
+            function.maxStackSize    = old.maxStackSize;
+            function.lines           = old.lines;
+            function.locals          = old.locals;
+            function.upvalues        = old.upvalues;
+            function.constants       = old.constants;
+            function.instructions    = old.instructions;
+            break;
+        }
+
+        case PATCH_FULL:
+            ReadBody(reader, function);
+            break;
+
+        default:
+            throw BadFileException();
+    }
+
+    // Every nested function starts with its operation
+    const size_t count = reader.ReadCount(1);
+    reader.Reserve(function.functions, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        function.functions.push_back(Function());
+        ReadPatchFunction(reader, entries, function.functions.back(), depth + 1);
+    }
+}
+
+Version ApplyPatch(istream& input, const File& oldFile, File& newFile)
+{
+    Reader reader(input);
+    Header header;
+    reader.Read(&header, sizeof header);
+    if (memcmp(header.signature, PATCH_SIGNATURE, 4) != 0 || header.patchVersion != PATCH_VERSION ||
+        header.version > LUA_UAW) {
+        throw BadFileException();
+    }
+
+    vector<FunctionEntry> entries;
+    if (IndexFunctions(oldFile.function, entries) != letohll(header.baseHash)) {
+        throw IOException("Patch does not apply to this file");
+    }
+
+    ReadPatchFunction(reader, entries, newFile.function, 0);
+    return (Version)header.version;
+}
+
+}
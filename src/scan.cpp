@@ -0,0 +1,87 @@
+#include <fstream>
+#include "scan.h"
+#include "formats.h"
+#include "corpus.h"
+#include "trace.h"
+using namespace std;
+
+namespace Lua {
+
+static const char* StatusNames[] = {"ok", "unknown", "invalid", "unreadable"};
+
+static const char* GetVersionName(Version version)
+{
+    return (version == LUA_UNKNOWN) ? "unknown" : VersionNames[version];
+}
+
+static void ScanFile(const string& root, ScanEntry& entry)
+{
+    TraceSpan span("scan", entry.file.c_str());
+
+    const filesystem::path path = GetFilePath(root, entry.file);
+    ifstream input(path, ios_base::binary | ios_base::in);
+    error_code error;
+    entry.size = filesystem::file_size(path, error);
+    if (!input.is_open() || error) {
+        entry.status = SCAN_UNREADABLE;
+        return;
+    }
+
+    bool valid;
+    entry.version = ReadAnyHeader(input, valid);
+    if (entry.version == LUA_UNKNOWN) {
+        entry.status = SCAN_UNKNOWN;
+    } else {
+        entry.status = valid ? SCAN_OK : SCAN_INVALID;
+    }
+}
+
+void ScanFiles(const string& root, vector<ScanEntry>& entries)
+{
+    vector<string> files;
+    ListFiles(root, files);
+
+    entries.resize(files.size());
+    ParallelFor(files.size(), [&](size_t i)
+    {
+        ScanEntry& entry = entries[i];
+        entry.file    = files[i];
+        entry.version = LUA_UNKNOWN;
+        entry.status  = SCAN_UNREADABLE;
+        entry.size    = 0;
+        ScanFile(root, entry);
+    });
+}
+
+void WriteScan(ostream& output, const vector<ScanEntry>& entries)
+{
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const ScanEntry& entry = entries[i];
+        output << entry.file << "\t" << GetVersionName(entry.version) << "\t" << StatusNames[entry.status] << "\t" << entry.size << "\n";
+    }
+}
+
+void WriteScanSummary(ostream& output, const vector<ScanEntry>& entries)
+{
+    size_t    valid[4] = {0}, statuses[4] = {0};
+    uintmax_t bytes[4] = {0};
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const ScanEntry& entry = entries[i];
+        statuses[entry.status]++;
+        if (entry.status == SCAN_OK) {
+            valid[entry.version]++;
+            bytes[entry.version] += entry.size;
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        output << VersionNames[i] << "\t" << valid[i] << " files\t" << bytes[i] << " bytes" << endl;
+    }
+    for (int i = SCAN_UNKNOWN; i <= SCAN_UNREADABLE; i++) {
+        output << StatusNames[i] << "\t" << statuses[i] << " files" << endl;
+    }
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef SCAN_H
+#define SCAN_H
+// Quick inventory of a corpus that reads only the header of every file
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "lua.h"
+
+namespace Lua
+{
+
+enum ScanStatus
+{
+    SCAN_OK,
+    SCAN_UNKNOWN,       // not a supported format
+    SCAN_INVALID,       // a supported format, but the header is not valid
+    SCAN_UNREADABLE,
+};
+
+struct ScanEntry
+{
+    std::string file;
+    Version     version;
+    ScanStatus  status;
+    uintmax_t   size;
+};
+
+// Detects the format of every file below root and validates its header, in
+// parallel. The entries are in the order of ListFiles.
+void ScanFiles(const std::string& root, std::vector<ScanEntry>& entries);
+
+// Writes a line of tab-separated file, format, status and size per entry
+void WriteScan(std::ostream& output, const std::vector<ScanEntry>& entries);
+
+// Writes the number of files per format and status
+void WriteScanSummary(std::ostream& output, const std::vector<ScanEntry>& entries);
+
+}
+#endif
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <type_traits>
+#include "sizes.h"
+#include "formats.h"
+#include "corpus.h"
+#include "exceptions.h"
+#include "trace.h"
+using namespace std;
+
+namespace Lua {
+
+// Names of the sections, indexed by Section
+static const char* SectionNames[] = {
+    "header", "code", "constants.nil", "constants.boolean", "constants.number", "constants.string", "lines", "locals", "upvalues"
+};
+
+SizeBreakdown::SizeBreakdown() : memory(0)
+{
+    fill(bytes, bytes + NUM_SECTIONS, 0);
+}
+
+uint64_t SizeBreakdown::Total() const
+{
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        total += bytes[i];
+    }
+    return total;
+}
+
+void SizeBreakdown::Add(const SizeBreakdown& other)
+{
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        bytes[i] += other.bytes[i];
+    }
+    memory += other.memory;
+}
+
+//
+// The sizes of a format, on disk as its codec writes it and in memory as the
+// game's 32-bit VM loads it
+//
+template <typename Format>
+struct FormatSizes
+{
+    static const bool IsNew = is_same<typename Format::Codec, Lua51::Codec>::value;
+
+    static const size_t FILE_HEADER = IsNew ? 12 : 22;      // the codecs' Header structures
+    static const size_t NUMBER      = sizeof(typename Format::Number);
+
+    static const size_t PROTO   = IsNew ? 76 : 72;
+    static const size_t TVALUE  = 2 * max<size_t>(NUMBER, 4);     // a value and its type tag
+    static const size_t TSTRING = 16;                               // followed by the characters
+    static const size_t LOCVAR  = 12;
+    static const size_t POINTER = 4;
+
+    static uint64_t String(const string& str)
+    {
+        return sizeof(int) + str.length() + 1;
+    }
+};
+
+template <typename Format>
+static uint64_t AnalyzeFunction(const Function& function, const string& file, const string& path, set<string>& strings, vector<FunctionSize>& functions)
+{
+    typedef FormatSizes<Format> Sizes;
+
+    const size_t index = functions.size();
+    functions.push_back(FunctionSize());
+    functions[index].file = file;
+    functions[index].path = path;
+
+    SizeBreakdown size;
+    uint64_t*     bytes = size.bytes;
+    uint64_t      stringMemory = 0;
+    auto          AddString = [&](const string& str)
+    {
+        if (!str.empty() && strings.insert(str).second) {
+            stringMemory += Sizes::TSTRING + str.length() + 1;
+        }
+    };
+
+    // The name is written as a null string when empty
+    bytes[SECTION_HEADER] += function.name.empty() ? sizeof(int) : Sizes::String(function.name);
+    bytes[SECTION_HEADER] += sizeof(int) * (Sizes::IsNew ? 2 : 1) + (Format::HasPetroInt ? sizeof(int) : 0) + 4;
+    bytes[SECTION_HEADER] += 2 * sizeof(int);   // the number of constants and of functions
+    AddString(function.name);
+
+    bytes[SECTION_CODE]  += sizeof(int) + sizeof(int) * function.instructions.size();
+    bytes[SECTION_LINES] += sizeof(int) + sizeof(int) * function.lines.size();
+
+    bytes[SECTION_LOCALS] += sizeof(int);
+    for (size_t i = 0; i < function.locals.size(); i++)
+    {
+        bytes[SECTION_LOCALS] += Sizes::String(function.locals[i].name) + 2 * sizeof(int);
+        AddString(function.locals[i].name);
+    }
+
+    bytes[SECTION_UPVALUES] += sizeof(int);
+    for (size_t i = 0; i < function.upvalues.size(); i++)
+    {
+        bytes[SECTION_UPVALUES] += Sizes::String(function.upvalues[i]);
+        AddString(function.upvalues[i]);
+    }
+
+    for (size_t i = 0; i < function.constants.size(); i++)
+    {
+        const Constant& constant = function.constants[i];
+        switch (constant.type)
+        {
+            case TNIL:     bytes[SECTION_NIL]     += 1; break;
+            case TBOOLEAN: bytes[SECTION_BOOLEAN] += 2; break;
+            case TNUMBER:  bytes[SECTION_NUMBER]  += 1 + Sizes::NUMBER; break;
+            default:
+                bytes[SECTION_STRING] += 1 + Sizes::String(constant.str);
+                AddString(constant.str);
+                break;
+        }
+    }
+
+    size.memory = Sizes::PROTO
+                + sizeof(int)     * function.instructions.size()
+                + Sizes::TVALUE   * function.constants.size()
+                + Sizes::POINTER  * function.functions.size()
+                + sizeof(int)     * function.lines.size()
+                + Sizes::LOCVAR   * function.locals.size()
+                + Sizes::POINTER  * function.upvalues.size()
+                + stringMemory;
+
+    uint64_t nested = 0;
+    for (size_t i = 0; i < function.functions.size(); i++) {
+        nested += AnalyzeFunction<Format>(function.functions[i], file, path + "." + to_string(i), strings, functions);
+    }
+
+    functions[index].size   = size;
+    functions[index].nested = nested;
+    return size.Total() + nested;
+}
+
+template <typename Format>
+static void AnalyzeFile(const File& file, Version version, const string& name, SizeReport& report)
+{
+    FileSize fileSize;
+    fileSize.file    = name;
+    fileSize.version = version;
+
+    set<string>  strings;
+    const size_t first = report.functions.size();
+    AnalyzeFunction<Format>(file.function, name, "main", strings, report.functions);
+
+    fileSize.nFunctions = report.functions.size() - first;
+    fileSize.size.bytes[SECTION_HEADER] = FormatSizes<Format>::FILE_HEADER;
+    for (size_t i = first; i < report.functions.size(); i++) {
+        fileSize.size.Add(report.functions[i].size);
+    }
+    report.total.Add(fileSize.size);
+    report.files.push_back(fileSize);
+}
+
+void AnalyzeSizes(const File& file, Version version, const string& name, SizeReport& report)
+{
+    switch (version)
+    {
+        case LUA_50:  AnalyzeFile<FormatLua50> (file, version, name, report); break;
+        case LUA_51:  AnalyzeFile<FormatLua51> (file, version, name, report); break;
+        case LUA_EAW: AnalyzeFile<FormatLupEaW>(file, version, name, report); break;
+        case LUA_UAW: AnalyzeFile<FormatLupUaW>(file, version, name, report); break;
+        default:      break;
+    }
+}
+
+void AnalyzeCorpus(const string& root, SizeReport& report, vector<string>& errors)
+{
+    vector<string> files;
+    ListFiles(root, files);
+
+    // Load and measure the files in parallel, each into its own report
+    vector<SizeReport> reports(files.size());
+    vector<string>     failures(files.size());
+    ParallelFor(files.size(), [&](size_t i)
+    {
+        try
+        {
+            ifstream input;
+            {
+                TraceSpan span("open", files[i].c_str());
+                input.open(GetFilePath(root, files[i]), ios_base::binary | ios_base::in);
+            }
+            if (!input.is_open()) {
+                throw FileNotFoundException();
+            }
+
+            File    file;
+            Version version = ReadAnyFile(input, file);
+            if (version == LUA_UNKNOWN) {
+                failures[i] = "not a supported Lua file";
+                return;
+            }
+
+            TraceSpan span("analyze", files[i].c_str());
+            AnalyzeSizes(file, version, files[i], reports[i]);
+        }
+        catch (exception& e)
+        {
+            failures[i] = e.what();
+        }
+    });
+
+    // Merge the results
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        if (!failures[i].empty()) {
+            errors.push_back(files[i] + ": " + failures[i]);
+            continue;
+        }
+        report.files.insert(report.files.end(), reports[i].files.begin(), reports[i].files.end());
+        report.functions.insert(report.functions.end(), reports[i].functions.begin(), reports[i].functions.end());
+        report.total.Add(reports[i].total);
+    }
+}
+
+//
+// Report
+//
+
+static void WriteSections(ostream& output, const SizeBreakdown& size)
+{
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        output << "\t" << size.bytes[i];
+    }
+}
+
+static void WriteSectionNames(ostream& output)
+{
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        output << "\t" << SectionNames[i];
+    }
+}
+
+void WriteSizeReport(ostream& output, SizeReport& report)
+{
+    // Largest first; equal sizes stay in name order
+    stable_sort(report.files.begin(), report.files.end(), [](const FileSize& a, const FileSize& b)
+    {
+        return a.size.Total() > b.size.Total();
+    });
+    stable_sort(report.functions.begin(), report.functions.end(), [](const FunctionSize& a, const FunctionSize& b)
+    {
+        return a.size.Total() > b.size.Total();
+    });
+
+    const uint64_t total = report.total.Total();
+    vector<int>    sections(NUM_SECTIONS);
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        sections[i] = i;
+    }
+    stable_sort(sections.begin(), sections.end(), [&](int a, int b) { return report.total.bytes[a] > report.total.bytes[b]; });
+
+    output << "# section\tbytes\tshare" << "\n";
+    for (int i = 0; i < NUM_SECTIONS; i++)
+    {
+        const uint64_t bytes = report.total.bytes[sections[i]];
+        output << SectionNames[sections[i]] << "\t" << bytes << "\t"
+               << fixed << setprecision(1) << (total > 0 ? bytes * 100.0 / total : 0) << defaultfloat << "%\n";
+    }
+    output << "total\t" << total << "\t100.0%\n";
+    output << "memory\t" << report.total.memory << "\n";
+
+    output << "\n# file\tformat\tfunctions\tbytes\tmemory";
+    WriteSectionNames(output);
+    output << "\n";
+    for (size_t i = 0; i < report.files.size(); i++)
+    {
+        const FileSize& file = report.files[i];
+        output << file.file << "\t" << VersionNames[file.version] << "\t" << file.nFunctions << "\t" << file.size.Total() << "\t" << file.size.memory;
+        WriteSections(output, file.size);
+        output << "\n";
+    }
+
+    output << "\n# file\tfunction\tbytes\tnested\tmemory";
+    WriteSectionNames(output);
+    output << "\n";
+    for (size_t i = 0; i < report.functions.size(); i++)
+    {
+        const FunctionSize& function = report.functions[i];
+        output << function.file << "\t" << function.path << "\t" << function.size.Total() << "\t" << function.nested << "\t" << function.size.memory;
+        WriteSections(output, function.size);
+        output << "\n";
+    }
+}
+
+}
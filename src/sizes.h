@@ -0,0 +1,76 @@
+#ifndef SIZES_H
+#define SIZES_H
+// Breakdown of where the bytes of compiled chunks go, on disk and in memory
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "lua.h"
+
+namespace Lua
+{
+
+enum Section
+{
+    SECTION_HEADER,         // file and function headers, nested function counts
+    SECTION_CODE,
+    SECTION_NIL,            // constants by type
+    SECTION_BOOLEAN,
+    SECTION_NUMBER,
+    SECTION_STRING,
+    SECTION_LINES,
+    SECTION_LOCALS,
+    SECTION_UPVALUES,
+    NUM_SECTIONS
+};
+
+struct SizeBreakdown
+{
+    uint64_t bytes[NUM_SECTIONS];   // as the chunk is written in its own format
+    uint64_t memory;                // estimated size of the loaded Protos
+
+    uint64_t Total() const;
+    void     Add(const SizeBreakdown& other);
+
+    SizeBreakdown();
+};
+
+struct FunctionSize
+{
+    std::string   file;
+    std::string   path;     // position in the function tree: main, main.0, ...
+    SizeBreakdown size;     // of the function itself
+    uint64_t      nested;   // bytes of the functions nested in it
+};
+
+struct FileSize
+{
+    std::string   file;
+    Version       version;
+    size_t        nFunctions;
+    SizeBreakdown size;
+};
+
+struct SizeReport
+{
+    std::vector<FileSize>     files;
+    std::vector<FunctionSize> functions;
+    SizeBreakdown             total;
+};
+
+// Adds the breakdown of a file and of every function in it to the report.
+// The memory estimate is for the game's 32-bit VM and counts every distinct
+// string once, for the first function that names it.
+void AnalyzeSizes(const File& file, Version version, const std::string& name, SizeReport& report);
+
+// Loads every file below root in parallel and adds its breakdown to the
+// report. Files that cannot be loaded are skipped and described in errors.
+void AnalyzeCorpus(const std::string& root, SizeReport& report, std::vector<std::string>& errors);
+
+// Writes the corpus total by section, then the files and the functions, each
+// sorted by size with the largest first, as tab-separated tables
+void WriteSizeReport(std::ostream& output, SizeReport& report);
+
+}
+#endif
@@ -0,0 +1,158 @@
+#include "analysis.h"
+#include "trace.h"
+using namespace std;
+
+namespace Lua {
+
+//
+// Stack size minimization
+//
+// Registers that are only ever named on their own can be given a new number
+// as long as the values of the registers that end up sharing a number are
+// never live at the same time. Every such register is moved to the lowest
+// register it does not interfere with, after which maxStackSize only needs to
+// cover the highest register still in use. Parameters, locals named by the
+// debug info, captured registers and registers that are part of a range keep
+// their number, so the debug info stays valid.
+//
+
+template <typename Layout>
+static void MinimizeFunctionStack(Function& function)
+{
+    for (size_t i = 0; i < function.functions.size(); i++) {
+        MinimizeFunctionStack<Layout>(function.functions[i]);
+    }
+
+    vector<DecodedInstruction> code;
+    vector<RegisterUsage>      usage;
+    if (!AnalyzeCode<Layout>(function, code, usage)) {
+        return;
+    }
+
+    const int nCode    = (int)code.size();
+    const int maxStack = min<int>(function.maxStackSize, Layout::MAXSTACK);
+
+    vector<RegisterSet> liveIn, liveOut;
+    ComputeLiveness(usage, liveIn, liveOut);
+
+    vector<int> localRegisters;
+    GetLocalRegisters(function, localRegisters);
+
+    // Registers that keep their number and that nothing else may share. The
+    // registers read before they are written rely on being nil at the start.
+    RegisterSet pinned, used;
+    AddRange(pinned, 0, GetParameterRegisters<Layout>(function) - 1);
+    for (size_t i = 0; i < localRegisters.size(); i++) {
+        pinned.set(localRegisters[i]);
+    }
+    if (nCode > 0) {
+        pinned |= liveIn[0];
+    }
+    for (int pc = 0; pc < nCode; pc++)
+    {
+        pinned |= usage[pc].fixed;
+        used   |= usage[pc].reads | usage[pc].writes;
+    }
+
+    // Two registers interfere when one is written while the other is live
+    vector<RegisterSet> interference(maxStack);
+    for (int pc = 0; pc < nCode; pc++)
+    {
+        const RegisterSet defs = usage[pc].writes | usage[pc].clobbers;
+        for (int r = 0; r < maxStack; r++)
+        {
+            if (defs.test(r))
+            {
+                interference[r] |= liveOut[pc];
+                interference[r].reset(r);
+            }
+        }
+    }
+    for (int r = 0; r < maxStack; r++)
+    {
+        for (int s = 0; s < maxStack; s++)
+        {
+            if (interference[r].test(s)) {
+                interference[s].set(r);
+            }
+        }
+    }
+
+    // Every register names a group of registers that share it. A register
+    // that moved to another one leaves its group empty; it is not reused.
+    vector<int>         rename(maxStack);
+    vector<bool>        moved(maxStack, false);
+    vector<RegisterSet> conflicts(interference);
+    bool                changed = false;
+    for (int r = 0; r < maxStack; r++)
+    {
+        rename[r] = r;
+        if (pinned.test(r) || !used.test(r)) {
+            continue;
+        }
+
+        for (int s = 0; s < r; s++)
+        {
+            if (!pinned.test(s) && !moved[s] && !conflicts[s].test(r))
+            {
+                rename[r]     = s;
+                moved[r]      = true;
+                conflicts[s] |= interference[r];
+                changed       = true;
+                break;
+            }
+        }
+    }
+
+    if (changed)
+    {
+        for (int pc = 0; pc < nCode; pc += max(usage[pc].length, 1))
+        {
+            Instruction&         i = function.instructions[pc];
+            const RegisterUsage& u = usage[pc];
+            if (u.a == OPERAND_REGISTER) {
+                i = Layout::SetA(i, rename[code[pc].a]);
+            }
+            if (u.b == OPERAND_REGISTER || (u.b == OPERAND_RK && !Layout::IsConstant(code[pc].b))) {
+                i = Layout::SetB(i, rename[code[pc].b]);
+            }
+            if (u.c == OPERAND_REGISTER || (u.c == OPERAND_RK && !Layout::IsConstant(code[pc].c))) {
+                i = Layout::SetC(i, rename[code[pc].c]);
+            }
+        }
+        AnalyzeCode<Layout>(function, code, usage);
+    }
+
+    // The stack must still hold the parameters and the locals, and the
+    // reference compiler never uses fewer than two registers
+    int highest = GetParameterRegisters<Layout>(function) - 1;
+    for (size_t i = 0; i < localRegisters.size(); i++) {
+        highest = max(highest, localRegisters[i]);
+    }
+    for (int pc = 0; pc < nCode; pc++) {
+        highest = max(highest, usage[pc].highest);
+    }
+    function.maxStackSize = (unsigned char)min<int>(function.maxStackSize, max(highest + 1, 2));
+}
+
+void MinimizeStack(File& file, Version version)
+{
+    TraceSpan span("minimize stack");
+    switch (version)
+    {
+        case LUA_50:
+        case LUA_EAW:
+            MinimizeFunctionStack<Lua50::Layout>(file.function);
+            break;
+
+        case LUA_51:
+        case LUA_UAW:
+            MinimizeFunctionStack<Lua51::Layout>(file.function);
+            break;
+
+        default:
+            break;
+    }
+}
+
+}
@@ -0,0 +1,112 @@
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trace.h"
+using namespace std;
+
+bool g_TraceEnabled = false;
+
+struct TraceEvent
+{
+    const char* name;
+    string      detail;
+    long long   start;
+    long long   duration;
+};
+
+// Every thread records into its own buffer, so recording takes no lock
+struct TraceBuffer
+{
+    int                thread;
+    vector<TraceEvent> events;
+};
+
+static chrono::steady_clock::time_point   g_TraceStart;
+static mutex                              g_TraceLock;
+static vector<unique_ptr<TraceBuffer> >   g_TraceBuffers;
+static thread_local TraceBuffer*          t_TraceBuffer = NULL;
+
+void StartTrace()
+{
+    g_TraceStart   = chrono::steady_clock::now();
+    g_TraceEnabled = true;
+}
+
+// Microseconds since the trace started
+long long GetTraceTime()
+{
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - g_TraceStart).count();
+}
+
+void AddTraceSpan(const char* name, const string& detail, long long start)
+{
+    const long long end = GetTraceTime();
+    if (t_TraceBuffer == NULL)
+    {
+        lock_guard<mutex> lock(g_TraceLock);
+        g_TraceBuffers.push_back(unique_ptr<TraceBuffer>(new TraceBuffer));
+        t_TraceBuffer = g_TraceBuffers.back().get();
+        t_TraceBuffer->thread = (int)g_TraceBuffers.size();
+    }
+
+    TraceEvent event;
+    event.name     = name;
+    event.detail   = detail;
+    event.start    = start;
+    event.duration = end - start;
+    t_TraceBuffer->events.push_back(event);
+}
+
+static void WriteJsonString(ostream& output, const string& str)
+{
+    static const char Hex[] = "0123456789abcdef";
+
+    output << '"';
+    for (size_t i = 0; i < str.length(); i++)
+    {
+        const unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            output << '\\' << c;
+        } else if (c < 0x20) {
+            output << "\\u00" << Hex[c >> 4] << Hex[c & 0xF];
+        } else {
+            output << c;
+        }
+    }
+    output << '"';
+}
+
+void WriteTrace(ostream& output)
+{
+    lock_guard<mutex> lock(g_TraceLock);
+
+    output << "{\"traceEvents\":[";
+    bool first = true;
+    for (size_t i = 0; i < g_TraceBuffers.size(); i++)
+    {
+        const TraceBuffer& buffer = *g_TraceBuffers[i];
+
+        output << (first ? "" : ",") << endl
+               << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.thread
+               << ",\"args\":{\"name\":\"thread " << buffer.thread << "\"}}";
+        first = false;
+
+        for (size_t j = 0; j < buffer.events.size(); j++)
+        {
+            const TraceEvent& event = buffer.events[j];
+            output << "," << endl << "{\"name\":";
+            WriteJsonString(output, event.name);
+            output << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.thread
+                   << ",\"ts\":" << event.start << ",\"dur\":" << event.duration;
+            if (!event.detail.empty())
+            {
+                output << ",\"args\":{\"detail\":";
+                WriteJsonString(output, event.detail);
+                output << "}";
+            }
+            output << "}";
+        }
+    }
+    output << endl << "]}" << endl;
+}
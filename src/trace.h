@@ -0,0 +1,46 @@
+#ifndef TRACE_H
+#define TRACE_H
+// Timing spans in the Chrome trace-event format, viewable in chrome://tracing
+// and Perfetto
+
+#include <ostream>
+#include <string>
+
+extern bool g_TraceEnabled;
+
+// Starts recording spans. Must be called before any other threads start.
+void StartTrace();
+
+// Writes all recorded spans as trace-event JSON. Must be called after all
+// threads that recorded spans have finished.
+void WriteTrace(std::ostream& output);
+
+long long GetTraceTime();
+void      AddTraceSpan(const char* name, const std::string& detail, long long start);
+
+// Records the time from its construction to its destruction on the current
+// thread. When tracing is off this costs one test of a global.
+class TraceSpan
+{
+    const char* m_name;
+    const char* m_detail;
+    long long   m_start;
+
+public:
+    explicit TraceSpan(const char* name, const char* detail = NULL)
+        : m_name(g_TraceEnabled ? name : NULL), m_detail(detail), m_start(0)
+    {
+        if (m_name != NULL) {
+            m_start = GetTraceTime();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (m_name != NULL) {
+            AddTraceSpan(m_name, (m_detail != NULL) ? m_detail : "", m_start);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include <sstream>
+#include "opcodes.h"
+#include "exceptions.h"
+#include "trace.h"
+using namespace std;
+
+namespace Lua {
+
+//
+// A single pass over every function that checks the operands the game's
+// VM trusts blindly. The checks follow the ones in the reference luaG_checkcode
+// but do not simulate the symbolic execution, so the cost is linear in the
+// number of instructions.
+//
+
+static void Fail(const string& path, int pc, const char* message)
+{
+    ostringstream msg;
+    msg << "Bad code in function " << path;
+    if (pc >= 0) {
+        msg << " at instruction " << pc;
+    }
+    msg << ": " << message;
+    throw BadCodeException(msg.str());
+}
+
+template <typename Layout>
+static void VerifyFunction(const Function& function, const string& path)
+{
+    const int maxStack = function.maxStackSize;
+    const int nConsts  = (int)function.constants.size();
+    const int nCode    = (int)function.instructions.size();
+
+    if (maxStack > Layout::MAXSTACK) {
+        Fail(path, -1, "stack size exceeds the limit");
+    }
+    if (function.nParameters + (function.isVararg & 1) > maxStack) {
+        Fail(path, -1, "parameters exceed stack size");
+    }
+    if (!function.lines.empty() && function.lines.size() != function.instructions.size()) {
+        Fail(path, -1, "line info does not match instructions");
+    }
+    if (!function.upvalues.empty() && function.upvalues.size() != function.nUpvalues) {
+        Fail(path, -1, "upvalue names do not match upvalue count");
+    }
+    for (size_t i = 0; i < function.locals.size(); i++)
+    {
+        const Local& local = function.locals[i];
+        if (local.startPC < 0 || local.startPC > local.endPC || local.endPC > nCode) {
+            Fail(path, -1, "local variable range out of bounds");
+        }
+    }
+    const CodeView<Layout> code(function.instructions);
+    for (int pc = 0; pc < nCode; pc++)
+    {
+        const InstructionView<Layout> i = code[pc];
+        if (!i.IsValid()) {
+            Fail(path, pc, "invalid opcode");
+        }
+
+        const OpInfo& info = i.Info();
+        const int a = i.A();
+        const int b = i.B();
+        const int c = i.C();
+        int last = -1;  // highest register used by ranges below
+
+        if (info.a == OpArgR && a >= maxStack) {
+            Fail(path, pc, "register A out of range");
+        }
+
+        switch (info.mode)
+        {
+            case iABC:
+                if ((info.b == OpArgR && b >= maxStack) || (info.c == OpArgR && c >= maxStack)) {
+                    Fail(path, pc, "register out of range");
+                }
+                if (info.b == OpArgK) {
+                    if (Layout::IsConstant(b) ? Layout::ConstantIndex(b) >= nConsts : b >= maxStack) {
+                        Fail(path, pc, "register or constant B out of range");
+                    }
+                }
+                if (info.c == OpArgK) {
+                    if (Layout::IsConstant(c) ? Layout::ConstantIndex(c) >= nConsts : c >= maxStack) {
+                        Fail(path, pc, "register or constant C out of range");
+                    }
+                }
+                break;
+
+            case iABx:
+                if (info.b == OpArgK && i.Bx() >= nConsts) {
+                    Fail(path, pc, "constant out of range");
+                }
+                break;
+
+            case iAsBx:
+            {
+                const int dest = pc + 1 + i.SBx();
+                if (dest < 0 || dest >= nCode) {
+                    Fail(path, pc, "jump target out of range");
+                }
+                break;
+            }
+        }
+
+        // A test either runs the jump after it or skips past it
+        if (info.test)
+        {
+            if (pc + 2 >= nCode) {
+                Fail(path, pc, "skip past end of code");
+            }
+            if (code[pc + 1].Op() != OP_JMP) {
+                Fail(path, pc, "test is not followed by a jump");
+            }
+        }
+
+        switch (info.op)
+        {
+            case OP_LOADBOOL:
+                if (c != 0 && pc + 2 >= nCode) {
+                    Fail(path, pc, "skip past end of code");
+                }
+                break;
+
+            case OP_GETUPVAL:
+            case OP_SETUPVAL:
+                if (b >= function.nUpvalues) {
+                    Fail(path, pc, "upvalue out of range");
+                }
+                break;
+
+            case OP_LOADNIL:  last = b; break;
+            case OP_CONCAT:   if (b >= c) Fail(path, pc, "empty concatenation"); break;
+            case OP_SELF:     last = a + 1; break;
+            case OP_CALL:
+            case OP_TAILCALL: last = max(b > 0 ? a + b - 1 : a, c > 1 ? a + c - 2 : a); break;
+            case OP_RETURN:   last = (b > 1) ? a + b - 2 : a; break;
+            case OP_VARARG:   last = (b > 1) ? a + b - 2 : a; break;
+            case OP_FORLOOP:  last = a + (Layout::IsNew ? 3 : 2); break;
+            case OP_FORPREP:  last = a + 3; break;
+            case OP_TFORPREP: last = a + 1; break;
+            case OP_TFORLOOP: last = Layout::IsNew ? a + 2 + c : a + c + 5; break;
+            case OP_SETLISTO: break;
+
+            case OP_SETLIST:
+                if (Layout::IsNew) {
+                    last = a + b;
+                    if (c == 0) {
+                        // The block number is stored in the next instruction
+                        if (++pc >= nCode) {
+                            Fail(path, pc - 1, "missing SETLIST block number");
+                        }
+                    }
+                } else {
+                    last = a + 1 + i.Bx() % 32;
+                }
+                break;
+
+            case OP_CLOSURE:
+            {
+                const int bx = i.Bx();
+                if (bx >= (int)function.functions.size()) {
+                    Fail(path, pc, "closure out of range");
+                }
+
+                // The upvalues are described by the pseudo-instructions that follow
+                const int nUpvalues = function.functions[bx].nUpvalues;
+                if (pc + nUpvalues >= nCode) {
+                    Fail(path, pc, "missing closure upvalues");
+                }
+                for (int j = 1; j <= nUpvalues; j++)
+                {
+                    const InstructionView<Layout> u = code[pc + j];
+                    const OpCode op = u.Op();
+                    const int    ub = u.B();
+                    if ((op != OP_MOVE && op != OP_GETUPVAL) ||
+                        (op == OP_MOVE     && ub >= maxStack) ||
+                        (op == OP_GETUPVAL && ub >= function.nUpvalues))
+                    {
+                        Fail(path, pc + j, "bad closure upvalue");
+                    }
+                }
+                pc += nUpvalues;
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        if (last >= maxStack) {
+            Fail(path, pc, "register range exceeds stack size");
+        }
+    }
+
+    if (nCode == 0 || code[nCode - 1].Op() != OP_RETURN) {
+        Fail(path, nCode - 1, "function does not end with RETURN");
+    }
+
+    for (size_t i = 0; i < function.functions.size(); i++)
+    {
+        ostringstream child;
+        child << path << "." << i;
+        VerifyFunction<Layout>(function.functions[i], child.str());
+    }
+}
+
+void VerifyFile(const File& file, Version version)
+{
+    TraceSpan span("verify");
+    switch (version)
+    {
+        case LUA_50:
+        case LUA_EAW:
+            VerifyFunction<Lua50::Layout>(file.function, "main");
+            break;
+
+        case LUA_51:
+        case LUA_UAW:
+            VerifyFunction<Lua51::Layout>(file.function, "main");
+            break;
+
+        default:
+            break;
+    }
+}
+
+}
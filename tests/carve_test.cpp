@@ -0,0 +1,30 @@
+#include "test.h"
+#include "../src/carve.h"
+using namespace std;
+using namespace Lua;
+
+// A chunk with a corrupt constant table and a truncated one around a valid one
+TEST(FindChunksSkipsCorruptChunks)
+{
+    File file;
+    file.function = MainFunction(2);
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+    const string chunk = SaveChunk(file, LUA_51);
+
+    // The constant count follows the header (12 bytes), the name (4 + 10),
+    // the line numbers, the four bytes of counts and the code (4 + 4). The
+    // data holds as many bytes as it claims constants, but none of them is
+    // a valid constant type.
+    const size_t sizekOffset = 12 + 14 + 8 + 4 + 8;
+    const size_t sizek       = 4096;
+    const string corrupt     = chunk.substr(0, sizekOffset) + EncodeInt(sizek) + string(sizek, '\xff');
+    const string truncated   = chunk.substr(0, chunk.size() - 1);
+    const string data        = "junk" + corrupt + chunk + truncated;
+
+    vector<CarvedChunk> chunks;
+    FindChunks(data.data(), data.size(), chunks);
+    CHECK(chunks.size() == 1);
+    CHECK(chunks[0].offset  == 4 + corrupt.size());
+    CHECK(chunks[0].size    == chunk.size());
+    CHECK(chunks[0].version == LUA_51);
+}
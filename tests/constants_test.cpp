@@ -0,0 +1,86 @@
+#include "test.h"
+using namespace std;
+using namespace Lua;
+
+typedef Lua51::Layout Layout;
+
+// A main function with more constants than RK operands can name, whose last
+// one is the number 7 and whose first two are 1 and "x"
+static File ManyConstants(unsigned char maxStackSize)
+{
+    File file;
+    file.function = MainFunction(maxStackSize);
+    file.function.constants.push_back(NumberConstant(1));
+    file.function.constants.push_back(StringConstant("x"));
+    for (int k = 2; k < 299; k++) {
+        file.function.constants.push_back(StringConstant("k" + to_string(k)));
+    }
+    file.function.constants.push_back(NumberConstant(7));
+    return file;
+}
+
+static double GetNumber(const Function& function, int rk)
+{
+    CHECK(Layout::IsConstant(rk));
+    const Constant& constant = function.constants[Layout::ConstantIndex(rk)];
+    CHECK(constant.type == TNUMBER);
+    return constant.number;
+}
+
+// x = 7 + 1
+TEST(ReorderConstantsFoldsLoads)
+{
+    File file = ManyConstants(1);
+    file.function.instructions.push_back(Op51::ABx(OP_LOADK,     0, 299));
+    file.function.instructions.push_back(Op51::ABC(OP_ADD,       0, 0, Layout::RKConstant(0)));
+    file.function.instructions.push_back(Op51::ABx(OP_SETGLOBAL, 0, 1));
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN,    0, 1, 0));
+
+    ReorderConstants(file, LUA_51);
+
+    const vector<Instruction>& code = file.function.instructions;
+    CHECK(code.size() == 3);
+    const InstructionView<Layout> add(code[0]);
+    CHECK(add.Op() == OP_ADD);
+    CHECK(GetNumber(file.function, add.B()) == 7);
+    CHECK(GetNumber(file.function, add.C()) == 1);
+
+    const InstructionView<Layout> store(code[1]);
+    CHECK(store.Op() == OP_SETGLOBAL);
+    CHECK(file.function.constants[store.Bx()].str == "x");
+}
+
+// repeat x = 7 + 1 until false, with the loop starting at the addition
+TEST(ReorderConstantsKeepsLoadsBeforeJumpTargets)
+{
+    File file = ManyConstants(1);
+    file.function.instructions.push_back(Op51::ABx (OP_LOADK,     0, 299));
+    file.function.instructions.push_back(Op51::ABC (OP_ADD,       0, 0, Layout::RKConstant(0)));
+    file.function.instructions.push_back(Op51::ABx (OP_SETGLOBAL, 0, 1));
+    file.function.instructions.push_back(Op51::AsBx(OP_JMP,       0, -3));
+    file.function.instructions.push_back(Op51::ABC (OP_RETURN,    0, 1, 0));
+    const vector<Instruction> original = file.function.instructions;
+
+    ReorderConstants(file, LUA_51);
+    CHECK(file.function.instructions == original);
+}
+
+// local y = 7; x = y + 1
+TEST(ReorderConstantsKeepsLoadsOfLocals)
+{
+    File file = ManyConstants(2);
+    file.function.instructions.push_back(Op51::ABx(OP_LOADK,     0, 299));
+    file.function.instructions.push_back(Op51::ABC(OP_ADD,       1, 0, Layout::RKConstant(0)));
+    file.function.instructions.push_back(Op51::ABx(OP_SETGLOBAL, 1, 1));
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN,    0, 1, 0));
+    const vector<Instruction> original = file.function.instructions;
+
+    Local local;
+    local.name    = "y";
+    local.startPC = 1;
+    local.endPC   = 4;
+    file.function.locals.push_back(local);
+
+    ReorderConstants(file, LUA_51);
+    CHECK(file.function.instructions == original);
+}
@@ -0,0 +1,46 @@
+#include <sstream>
+#include "test.h"
+#include "../src/formats.h"
+#include "../src/exceptions.h"
+using namespace std;
+using namespace Lua;
+
+// A chunk that claims far more instructions than the rest of the file holds
+TEST(ReadAnyFileRejectsHugeCounts)
+{
+    File file;
+    file.function = MainFunction(2);
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+    const string chunk = SaveChunk(file, LUA_51);
+
+    // The instruction count follows the header (12 bytes), the name (4 + 10),
+    // the line numbers and the four bytes of counts
+    const size_t sizecodeOffset = 12 + 14 + 8 + 4;
+    const string truncated      = chunk.substr(0, sizecodeOffset) + EncodeInt(0x10000000) + EncodeInt(0);
+
+    // The format is detected from a peeked header, which must not hide the
+    // size of the stream from the reader
+    istringstream input(truncated, ios_base::in | ios_base::binary);
+    File loaded;
+    bool rejected = false;
+    try {
+        ReadAnyFile(input, loaded);
+    } catch (BadFileException&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+TEST(ReadAnyFileReadsPeekedHeader)
+{
+    File file;
+    file.function = MainFunction(2);
+    file.function.constants.push_back(StringConstant("x"));
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+    const string chunk = SaveChunk(file, LUA_51);
+
+    istringstream input(chunk, ios_base::in | ios_base::binary);
+    File loaded;
+    CHECK(ReadAnyFile(input, loaded) == LUA_51);
+    CHECK(SaveChunk(loaded, LUA_51) == chunk);
+}
@@ -0,0 +1,116 @@
+#include "test.h"
+using namespace std;
+using namespace Lua;
+
+// Returns the positions of the GETGLOBALs or SETGLOBALs of a name
+static vector<int> FindGlobalAccesses(const Function& function, OpCode op, const string& name)
+{
+    vector<int> positions;
+    for (size_t pc = 0; pc < function.instructions.size(); pc++)
+    {
+        const InstructionView<Lua51::Layout> i(function.instructions[pc]);
+        if (i.Op() == op && function.constants[i.Bx()].str == name) {
+            positions.push_back((int)pc);
+        }
+    }
+    return positions;
+}
+
+// X = 1; while true do f(X) end
+TEST(CacheGlobalsKeepsAssignmentBeforeLoop)
+{
+    File file;
+    file.function = MainFunction(2);
+    file.function.constants.push_back(NumberConstant(1));
+    file.function.constants.push_back(StringConstant("X"));
+    file.function.constants.push_back(StringConstant("f"));
+    file.function.instructions.push_back(Op51::ABx (OP_LOADK,     0, 0));
+    file.function.instructions.push_back(Op51::ABx (OP_SETGLOBAL, 0, 1));
+    file.function.instructions.push_back(Op51::ABx (OP_GETGLOBAL, 0, 2));
+    file.function.instructions.push_back(Op51::ABx (OP_GETGLOBAL, 1, 1));
+    file.function.instructions.push_back(Op51::ABC (OP_CALL,      0, 2, 1));
+    file.function.instructions.push_back(Op51::AsBx(OP_JMP,       0, -4));
+    file.function.instructions.push_back(Op51::ABC (OP_RETURN,    0, 1, 0));
+
+    VerifyFile(file, LUA_51);
+    CacheGlobals(file, LUA_51);
+    VerifyFile(file, LUA_51);
+
+    // Every read of X must still see the value the assignment stored
+    const vector<int> writes = FindGlobalAccesses(file.function, OP_SETGLOBAL, "X");
+    const vector<int> reads  = FindGlobalAccesses(file.function, OP_GETGLOBAL, "X");
+    CHECK(writes.size() == 1);
+    CHECK(!reads.empty());
+    for (size_t i = 0; i < reads.size(); i++) {
+        CHECK(reads[i] > writes[0]);
+    }
+}
+
+// local a = 1; while true do f(X) end
+TEST(CacheGlobalsLoadsBeforeLoop)
+{
+    File file;
+    file.function = MainFunction(3);
+    file.function.constants.push_back(NumberConstant(1));
+    file.function.constants.push_back(StringConstant("X"));
+    file.function.constants.push_back(StringConstant("f"));
+    file.function.instructions.push_back(Op51::ABx (OP_LOADK,     0, 0));
+    file.function.instructions.push_back(Op51::ABx (OP_GETGLOBAL, 1, 2));
+    file.function.instructions.push_back(Op51::ABx (OP_GETGLOBAL, 2, 1));
+    file.function.instructions.push_back(Op51::ABC (OP_CALL,      1, 2, 1));
+    file.function.instructions.push_back(Op51::AsBx(OP_JMP,       0, -4));
+    file.function.instructions.push_back(Op51::ABC (OP_RETURN,    0, 1, 0));
+
+    CacheGlobals(file, LUA_51);
+    VerifyFile(file, LUA_51);
+
+    // Both globals are loaded once, before the loop, which now starts at 3
+    const vector<int> reads = FindGlobalAccesses(file.function, OP_GETGLOBAL, "X");
+    CHECK(file.function.instructions.size() == 8);
+    CHECK(reads.size() == 1 && reads[0] < 3);
+    CHECK(FindGlobalAccesses(file.function, OP_GETGLOBAL, "f").size() == 1);
+}
+
+// local a = 1; while true do f() end; a = 1; while true do g() end
+TEST(CacheGlobalsLoadsBeforeEveryLoop)
+{
+    File file;
+    file.function = MainFunction(2);
+    file.function.constants.push_back(NumberConstant(1));
+    file.function.constants.push_back(StringConstant("f"));
+    file.function.constants.push_back(StringConstant("g"));
+    for (int k = 1; k <= 2; k++)
+    {
+        file.function.instructions.push_back(Op51::ABx (OP_LOADK,     0, 0));
+        file.function.instructions.push_back(Op51::ABx (OP_GETGLOBAL, 1, k));
+        file.function.instructions.push_back(Op51::ABC (OP_CALL,      1, 1, 1));
+        file.function.instructions.push_back(Op51::AsBx(OP_JMP,       0, -3));
+    }
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+    file.function.lines.assign(file.function.instructions.size(), 1);
+
+    Local local;
+    local.name    = "a";
+    local.startPC = 1;
+    local.endPC   = 9;
+    file.function.locals.push_back(local);
+
+    CacheGlobals(file, LUA_51);
+    VerifyFile(file, LUA_51);
+
+    // Each loop gets its load in front and still jumps back to its first
+    // instruction, which the locals follow
+    const Function& function = file.function;
+    CHECK(function.instructions.size() == 11);
+    CHECK(function.lines.size() == 11);
+    CHECK(FindGlobalAccesses(function, OP_GETGLOBAL, "f") == vector<int>(1, 0));
+    CHECK(FindGlobalAccesses(function, OP_GETGLOBAL, "g") == vector<int>(1, 5));
+    for (int pc = 4; pc <= 9; pc += 5)
+    {
+        const InstructionView<Lua51::Layout> jump(function.instructions[pc]);
+        CHECK(jump.Op() == OP_JMP && pc + 1 + jump.SBx() == pc - 2);
+    }
+    CHECK(function.locals.size() == 3);
+    CHECK(function.locals[2].name == "a");
+    CHECK(function.locals[2].startPC == 2 && function.locals[2].endPC == 11);
+}
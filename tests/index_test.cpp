@@ -0,0 +1,97 @@
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "test.h"
+#include "../src/index.h"
+using namespace std;
+using namespace Lua;
+namespace fs = std::filesystem;
+
+static void WriteFile(const fs::path& path, const string& data)
+{
+    ofstream output(path, ios_base::binary | ios_base::out);
+    output.write(data.data(), (streamsize)data.size());
+}
+
+// a.luac reads x and has a function on lines 3 to 5 that writes y;
+// b.luac writes x; junk.txt is not a chunk
+static string BuildTestIndex(vector<string>& errors)
+{
+    File a;
+    a.function = MainFunction(1);
+    a.function.constants.push_back(StringConstant("x"));
+    a.function.instructions.push_back(Op51::ABx(OP_GETGLOBAL, 0, 0));
+    a.function.instructions.push_back(Op51::ABC(OP_RETURN,    0, 1, 0));
+
+    Function nested = MainFunction(1);
+    nested.name            = "";
+    nested.lineDefined     = 3;
+    nested.lastLineDefined = 5;
+    nested.isVararg        = 0;
+    nested.constants.push_back(StringConstant("y"));
+    nested.instructions.push_back(Op51::ABC(OP_LOADNIL,   0, 0, 0));
+    nested.instructions.push_back(Op51::ABx(OP_SETGLOBAL, 0, 0));
+    nested.instructions.push_back(Op51::ABC(OP_RETURN,    0, 1, 0));
+    a.function.functions.push_back(nested);
+
+    File b;
+    b.function = MainFunction(1);
+    b.function.constants.push_back(StringConstant("x"));
+    b.function.instructions.push_back(Op51::ABC(OP_LOADNIL,   0, 0, 0));
+    b.function.instructions.push_back(Op51::ABx(OP_SETGLOBAL, 0, 0));
+    b.function.instructions.push_back(Op51::ABC(OP_RETURN,    0, 1, 0));
+
+    const fs::path root = fs::temp_directory_path() / "luacvt-index-test";
+    fs::remove_all(root);
+    fs::create_directories(root);
+    WriteFile(root / "a.luac",   SaveChunk(a, LUA_51));
+    WriteFile(root / "b.luac",   SaveChunk(b, LUA_51));
+    WriteFile(root / "junk.txt", "not a chunk");
+
+    ostringstream output(ios_base::out | ios_base::binary);
+    BuildIndex(root.u8string(), output, errors);
+    fs::remove_all(root);
+    return output.str();
+}
+
+TEST(IndexFindsGlobals)
+{
+    vector<string> errors;
+    istringstream  input(BuildTestIndex(errors), ios_base::in | ios_base::binary);
+    CHECK(errors.size() == 1);
+
+    const Index index(input);
+    vector<GlobalUse> uses;
+    index.FindGlobal("x", uses);
+    CHECK(uses.size() == 2);
+    CHECK(uses[0].function.file == "a.luac" && uses[0].function.path == "main");
+    CHECK(uses[0].reads && !uses[0].writes);
+    CHECK(uses[1].function.file == "b.luac" && uses[1].function.path == "main");
+    CHECK(!uses[1].reads && uses[1].writes);
+
+    uses.clear();
+    index.FindGlobal("y", uses);
+    CHECK(uses.size() == 1);
+    CHECK(uses[0].function.path == "main.0" && uses[0].writes);
+
+    uses.clear();
+    index.FindGlobal("z", uses);
+    CHECK(uses.empty());
+}
+
+TEST(IndexFindsInnermostFunction)
+{
+    vector<string> errors;
+    istringstream  input(BuildTestIndex(errors), ios_base::in | ios_base::binary);
+
+    const Index index(input);
+    IndexedFunction function;
+    CHECK(index.FindLine("a.luac", 4, function));
+    CHECK(function.file == "a.luac" && function.path == "main.0");
+    CHECK(function.firstLine == 3 && function.lastLine == 5);
+
+    CHECK(index.FindLine("a.luac", 7, function));
+    CHECK(function.path == "main");
+
+    CHECK(!index.FindLine("c.luac", 1, function));
+}
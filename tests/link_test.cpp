@@ -0,0 +1,81 @@
+#include <sstream>
+#include "test.h"
+#include "../src/formats.h"
+#include "../src/exceptions.h"
+using namespace std;
+using namespace Lua;
+
+typedef Lua51::Layout Layout;
+
+static File ScriptFile(const string& name)
+{
+    File file;
+    file.function      = MainFunction(1);
+    file.function.name = name;
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+    return file;
+}
+
+// Returns the Petroglyph integer of the function with the name in a saved chunk
+static int GetPetroValue(const string& chunk, const string& name)
+{
+    const size_t offset = chunk.find(name + '\0');
+    CHECK(offset != string::npos);
+    const string value = chunk.substr(offset + name.size() + 1 + 8, 4);
+    return (int)((unsigned char)value[0] | (unsigned char)value[1] << 8 |
+                 (unsigned char)value[2] << 16 | (unsigned char)value[3] << 24);
+}
+
+TEST(LinkFilesCallsEveryMainFunction)
+{
+    vector<File> files;
+    files.push_back(ScriptFile("@a.lua"));
+    files.push_back(ScriptFile("@b.lua"));
+    File nested = ScriptFile("@nested");
+    files[0].function.functions.push_back(nested.function);
+
+    File linked;
+    LinkFiles(files, LUA_51, linked);
+    VerifyFile(linked, LUA_51);
+
+    const Function& loader = linked.function;
+    CHECK(loader.functions.size() == 2);
+    CHECK(loader.functions[0].name == "@a.lua");
+    CHECK(loader.functions[1].name == "@b.lua");
+    CHECK(loader.instructions.size() == 5);
+    for (int i = 0; i < 2; i++)
+    {
+        const InstructionView<Layout> closure(loader.instructions[2 * i]);
+        const InstructionView<Layout> call   (loader.instructions[2 * i + 1]);
+        CHECK(closure.Op() == OP_CLOSURE && closure.A() == 0 && closure.Bx() == i);
+        CHECK(call.Op() == OP_CALL && call.A() == 0 && call.B() == 1 && call.C() == 1);
+    }
+    CHECK(InstructionView<Layout>(loader.instructions[4]).Op() == OP_RETURN);
+
+    // The loader and every function below it are numbered in preorder
+    ostringstream output(ios_base::out | ios_base::binary);
+    LuaFormats[LUA_51].output->Save(output, linked);
+    const string chunk = output.str();
+    CHECK(GetPetroValue(chunk, "=linked") == 1);
+    CHECK(GetPetroValue(chunk, "@a.lua")  == 2);
+    CHECK(GetPetroValue(chunk, "@nested") == 3);
+    CHECK(GetPetroValue(chunk, "@b.lua")  == 4);
+}
+
+TEST(LinkFilesRejectsUpvalues)
+{
+    vector<File> files;
+    files.push_back(ScriptFile("@a.lua"));
+    files.push_back(ScriptFile("@b.lua"));
+    files[1].function.nUpvalues = 1;
+    files[1].function.upvalues.push_back("x");
+
+    File linked;
+    bool rejected = false;
+    try {
+        LinkFiles(files, LUA_51, linked);
+    } catch (BadCodeException&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
@@ -0,0 +1,97 @@
+#include <sstream>
+#include "test.h"
+#include "../src/exceptions.h"
+using namespace std;
+using namespace Lua;
+
+// A function that returns the given constant
+static Function ReturnFunction(double value, int line)
+{
+    Function function = MainFunction(1);
+    function.name        = "";
+    function.lineDefined = line;
+    function.isVararg    = 0;
+    function.constants.push_back(NumberConstant(value));
+    function.instructions.push_back(Op51::ABx(OP_LOADK,  0, 0));
+    function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 2, 0));
+    return function;
+}
+
+static string Diff(const File& oldFile, const File& newFile)
+{
+    ostringstream output(ios_base::out | ios_base::binary);
+    WritePatch(output, oldFile, newFile, LUA_51);
+    return output.str();
+}
+
+static Version Patch(const string& patch, const File& oldFile, File& newFile)
+{
+    istringstream input(patch, ios_base::in | ios_base::binary);
+    return ApplyPatch(input, oldFile, newFile);
+}
+
+TEST(PatchRoundTrip)
+{
+    File oldFile;
+    oldFile.function = MainFunction(2);
+    oldFile.function.functions.push_back(ReturnFunction(1, 1));
+    oldFile.function.functions.push_back(ReturnFunction(2, 2));
+    oldFile.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+
+    // Keeps the first function, changes the second and adds a third
+    File newFile = oldFile;
+    newFile.function.functions[1].constants[0] = NumberConstant(3);
+    newFile.function.functions.push_back(ReturnFunction(4, 3));
+
+    File patched;
+    CHECK(Patch(Diff(oldFile, newFile), oldFile, patched) == LUA_51);
+    CHECK(SaveChunk(patched, LUA_51) == SaveChunk(newFile, LUA_51));
+
+    // An unchanged file costs no more than the header and one function
+    CHECK(Diff(oldFile, oldFile).size() < 32);
+}
+
+TEST(PatchRejectsOtherBase)
+{
+    File oldFile;
+    oldFile.function = MainFunction(2);
+    oldFile.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+
+    File otherFile = oldFile;
+    otherFile.function.functions.push_back(ReturnFunction(1, 1));
+
+    File patched;
+    bool rejected = false;
+    try {
+        Patch(Diff(oldFile, oldFile), otherFile, patched);
+    } catch (IOException&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
+
+TEST(PatchRejectsDeepNesting)
+{
+    File oldFile;
+    oldFile.function = MainFunction(2);
+    oldFile.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+
+    // Nests far more functions than any compiler would
+    File newFile;
+    newFile.function = ReturnFunction(0, 0);
+    for (int i = 1; i < 300; i++)
+    {
+        Function outer = ReturnFunction(i, i);
+        outer.functions.push_back(newFile.function);
+        newFile.function = outer;
+    }
+
+    File patched;
+    bool rejected = false;
+    try {
+        Patch(Diff(oldFile, newFile), oldFile, patched);
+    } catch (BadFileException&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}
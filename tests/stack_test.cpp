@@ -0,0 +1,101 @@
+#include "test.h"
+using namespace std;
+using namespace Lua;
+
+// x = 1; y = 2; z = 3, each through its own temporary
+TEST(MinimizeStackSharesDisjointRegisters)
+{
+    File file;
+    file.function = MainFunction(3);
+    file.function.constants.push_back(StringConstant("x"));
+    file.function.constants.push_back(StringConstant("y"));
+    file.function.constants.push_back(StringConstant("z"));
+    for (int r = 0; r < 3; r++)
+    {
+        file.function.instructions.push_back(Op51::ABx(OP_LOADK,     r, r));
+        file.function.instructions.push_back(Op51::ABx(OP_SETGLOBAL, r, r));
+    }
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+
+    MinimizeStack(file, LUA_51);
+    VerifyFile(file, LUA_51);
+
+    // None of the temporaries is live at the same time as another
+    CHECK(file.function.maxStackSize == 2);
+    for (int pc = 0; pc < 6; pc += 2)
+    {
+        const InstructionView<Lua51::Layout> load (file.function.instructions[pc]);
+        const InstructionView<Lua51::Layout> store(file.function.instructions[pc + 1]);
+        CHECK(load.A() == store.A());
+        CHECK(load.A() < 2);
+    }
+}
+
+// t[k] = v with all three live at once
+TEST(MinimizeStackKeepsOverlappingRegisters)
+{
+    File file;
+    file.function = MainFunction(3);
+    file.function.constants.push_back(NumberConstant(1));
+    file.function.instructions.push_back(Op51::ABC(OP_NEWTABLE, 0, 0, 0));
+    file.function.instructions.push_back(Op51::ABx(OP_LOADK,    1, 0));
+    file.function.instructions.push_back(Op51::ABx(OP_LOADK,    2, 0));
+    file.function.instructions.push_back(Op51::ABC(OP_SETTABLE, 0, 1, 2));
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN,   0, 1, 0));
+
+    MinimizeStack(file, LUA_51);
+    VerifyFile(file, LUA_51);
+    CHECK(file.function.maxStackSize == 3);
+}
+
+// x = 1; f(2), with the call at registers 2 and 3
+TEST(MinimizeStackKeepsCallRange)
+{
+    File file;
+    file.function = MainFunction(6);
+    file.function.constants.push_back(NumberConstant(1));
+    file.function.constants.push_back(StringConstant("x"));
+    file.function.constants.push_back(StringConstant("f"));
+    file.function.instructions.push_back(Op51::ABx(OP_LOADK,     5, 0));
+    file.function.instructions.push_back(Op51::ABx(OP_SETGLOBAL, 5, 1));
+    file.function.instructions.push_back(Op51::ABx(OP_GETGLOBAL, 2, 2));
+    file.function.instructions.push_back(Op51::ABx(OP_LOADK,     3, 0));
+    file.function.instructions.push_back(Op51::ABC(OP_CALL,      2, 2, 1));
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN,    0, 1, 0));
+
+    MinimizeStack(file, LUA_51);
+    VerifyFile(file, LUA_51);
+
+    // The temporary moves down, but the function and its argument stay
+    // next to each other where the call expects them
+    const InstructionView<Lua51::Layout> load    (file.function.instructions[0]);
+    const InstructionView<Lua51::Layout> function(file.function.instructions[2]);
+    const InstructionView<Lua51::Layout> argument(file.function.instructions[3]);
+    const InstructionView<Lua51::Layout> call    (file.function.instructions[4]);
+    CHECK(load.A() < 2);
+    CHECK(function.A() == call.A() && argument.A() == call.A() + 1);
+    CHECK(file.function.maxStackSize == 4);
+}
+
+// local t = {}; for k, v in pairs(t) do end, compiled by Lua 5.0
+TEST(MinimizeStackKeepsIteratorCallOfLua50)
+{
+    File file;
+    file.function = MainFunction(8);
+    file.function.constants.push_back(StringConstant("pairs"));
+    file.function.instructions.push_back(Op50::ABC (OP_NEWTABLE,  0, 0, 0));
+    file.function.instructions.push_back(Op50::ABx (OP_GETGLOBAL, 1, 0));
+    file.function.instructions.push_back(Op50::ABC (OP_MOVE,      2, 0, 0));
+    file.function.instructions.push_back(Op50::ABC (OP_CALL,      1, 2, 4));
+    file.function.instructions.push_back(Op50::AsBx(OP_TFORPREP,  1, 0));
+    file.function.instructions.push_back(Op50::ABC (OP_TFORLOOP,  1, 0, 1));
+    file.function.instructions.push_back(Op50::AsBx(OP_JMP,       0, -2));
+    file.function.instructions.push_back(Op50::ABC (OP_RETURN,    0, 1, 0));
+
+    MinimizeStack(file, LUA_50);
+    VerifyFile(file, LUA_50);
+
+    // The VM calls the iterator from a copy at A+C+3 with two arguments
+    const InstructionView<Lua50::Layout> loop(file.function.instructions[5]);
+    CHECK(file.function.maxStackSize >= loop.A() + loop.C() + 6);
+}
@@ -0,0 +1,101 @@
+#include <iostream>
+#include <sstream>
+#include "test.h"
+#include "../src/formats.h"
+using namespace std;
+using namespace Lua;
+
+struct Test
+{
+    const char*  name;
+    TestFunction function;
+};
+
+static vector<Test>& GetTests()
+{
+    static vector<Test> tests;
+    return tests;
+}
+
+TestRegistration::TestRegistration(const char* name, TestFunction function)
+{
+    Test test = {name, function};
+    GetTests().push_back(test);
+}
+
+//
+// Chunk building
+//
+
+Constant NumberConstant(double value)
+{
+    Constant constant;
+    constant.type    = TNUMBER;
+    constant.number  = value;
+    constant.boolean = false;
+    return constant;
+}
+
+Constant StringConstant(const string& value)
+{
+    Constant constant;
+    constant.type    = TSTRING;
+    constant.str     = value;
+    constant.number  = 0;
+    constant.boolean = false;
+    return constant;
+}
+
+Function MainFunction(unsigned char maxStackSize)
+{
+    Function function;
+    function.name            = "@test.lua";
+    function.lineDefined     = 0;
+    function.lastLineDefined = 0;
+    function.nUpvalues       = 0;
+    function.nParameters     = 0;
+    function.isVararg        = 2;
+    function.maxStackSize    = maxStackSize;
+    return function;
+}
+
+string SaveChunk(const File& file, Version version)
+{
+    ostringstream output(ios_base::out | ios_base::binary);
+    LuaFormats[version].input->Save(output, file);
+    return output.str();
+}
+
+string EncodeInt(unsigned int value)
+{
+    string bytes;
+    for (int i = 0; i < 4; i++) {
+        bytes += (char)(value >> (8 * i));
+    }
+    return bytes;
+}
+
+int main()
+{
+    int failures = 0;
+    for (size_t i = 0; i < GetTests().size(); i++)
+    {
+        const Test& test = GetTests()[i];
+        try
+        {
+            test.function();
+            cout << "PASS " << test.name << endl;
+        }
+        catch (TestFailure& failure)
+        {
+            cout << "FAIL " << test.name << ": " << failure.message << endl;
+            failures++;
+        }
+        catch (exception& e)
+        {
+            cout << "FAIL " << test.name << ": " << e.what() << endl;
+            failures++;
+        }
+    }
+    return failures;
+}
@@ -0,0 +1,62 @@
+#ifndef TEST_H
+#define TEST_H
+// A minimal test harness and helpers that build chunks in memory. Every test
+// runs the code under test directly; the program returns the number of
+// failed tests.
+
+#include <string>
+#include <vector>
+#include "../src/lua.h"
+#include "../src/opcodes.h"
+
+typedef void (*TestFunction)();
+
+struct TestRegistration
+{
+    TestRegistration(const char* name, TestFunction function);
+};
+
+#define TEST(name) \
+    static void Test_##name(); \
+    static TestRegistration Registration_##name(#name, Test_##name); \
+    static void Test_##name()
+
+struct TestFailure
+{
+    std::string message;
+};
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            TestFailure failure = {std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " + #condition}; \
+            throw failure; \
+        } \
+    } while (false)
+
+//
+// Chunk building
+//
+
+Lua::Constant NumberConstant(double value);
+Lua::Constant StringConstant(const std::string& value);
+Lua::Function MainFunction(unsigned char maxStackSize);
+
+// Saves the file in the format of its version, not the one it converts to
+std::string SaveChunk(const Lua::File& file, Lua::Version version);
+
+// Encodes an int the way every format stores it
+std::string EncodeInt(unsigned int value);
+
+template <typename L>
+struct Instructions
+{
+    static Lua::Instruction ABC (Lua::OpCode op, int a, int b, int c) { return L::CreateABC (Lua::GetOpcodeNumber<L>(op), a, b, c); }
+    static Lua::Instruction ABx (Lua::OpCode op, int a, int bx)       { return L::CreateABx (Lua::GetOpcodeNumber<L>(op), a, bx); }
+    static Lua::Instruction AsBx(Lua::OpCode op, int a, int sbx)      { return L::CreateAsBx(Lua::GetOpcodeNumber<L>(op), a, sbx); }
+};
+
+typedef Instructions<Lua::Lua50::Layout> Op50;
+typedef Instructions<Lua::Lua51::Layout> Op51;
+
+#endif
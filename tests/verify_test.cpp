@@ -0,0 +1,79 @@
+#include "test.h"
+#include "../src/exceptions.h"
+using namespace std;
+using namespace Lua;
+
+// Returns whether the verifier rejects the code of a main function
+static bool VerifyRejects(const vector<Instruction>& instructions)
+{
+    File file;
+    file.function = MainFunction(2);
+    file.function.instructions = instructions;
+    try
+    {
+        VerifyFile(file, LUA_51);
+        return false;
+    }
+    catch (BadCodeException&)
+    {
+        return true;
+    }
+}
+
+TEST(VerifyChecksTestSkips)
+{
+    const Instruction eq   = Op51::ABC (OP_EQ,       0, 0, 1);
+    const Instruction jmp  = Op51::AsBx(OP_JMP,      0, 0);
+    const Instruction back = Op51::AsBx(OP_JMP,      0, -2);
+    const Instruction move = Op51::ABC (OP_MOVE,     0, 1, 0);
+    const Instruction ret  = Op51::ABC (OP_RETURN,   0, 1, 0);
+    const Instruction skip = Op51::ABC (OP_LOADBOOL, 0, 1, 1);
+
+    CHECK(!VerifyRejects({eq, jmp, ret}));
+    CHECK( VerifyRejects({eq, move, ret}));
+    CHECK( VerifyRejects({ret, eq, back}));
+    CHECK(!VerifyRejects({skip, move, ret}));
+    CHECK( VerifyRejects({move, skip, ret}));
+}
+
+TEST(VerifyChecksIteratorCallOfLua50)
+{
+    // for k, v in pairs(t) do end, with the loop at register 1
+    File file;
+    file.function = MainFunction(7);
+    file.function.constants.push_back(StringConstant("pairs"));
+    file.function.instructions.push_back(Op50::ABC (OP_NEWTABLE,  0, 0, 0));
+    file.function.instructions.push_back(Op50::ABx (OP_GETGLOBAL, 1, 0));
+    file.function.instructions.push_back(Op50::ABC (OP_MOVE,      2, 0, 0));
+    file.function.instructions.push_back(Op50::ABC (OP_CALL,      1, 2, 4));
+    file.function.instructions.push_back(Op50::AsBx(OP_TFORPREP,  1, 0));
+    file.function.instructions.push_back(Op50::ABC (OP_TFORLOOP,  1, 0, 1));
+    file.function.instructions.push_back(Op50::AsBx(OP_JMP,       0, -2));
+    file.function.instructions.push_back(Op50::ABC (OP_RETURN,    0, 1, 0));
+
+    // The iterator is called at A+C+3 and its arguments reach A+C+5
+    bool rejected = false;
+    try {
+        VerifyFile(file, LUA_50);
+    } catch (BadCodeException&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+
+    file.function.maxStackSize = 8;
+    VerifyFile(file, LUA_50);
+}
+
+TEST(VerifyChecksStackLimit)
+{
+    File file;
+    file.function = MainFunction(255);
+    file.function.instructions.push_back(Op51::ABC(OP_RETURN, 0, 1, 0));
+    bool rejected = false;
+    try {
+        VerifyFile(file, LUA_51);
+    } catch (BadCodeException&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+}